@@ -12,22 +12,28 @@ const int kWindowHeight = 1024;
 
 std::string message;
 
-SDL_Texture* LoadImage(const std::string& fname)
+RepaUI::ImageHandle LoadImage(const std::string& fname)
 {
-  SDL_Texture* res = nullptr;
   SDL_Surface* s = SDL_LoadBMP(fname.data());
-  res = SDL_CreateTextureFromSurface(_renderer, s);
+  RepaUI::ImageHandle res = RepaUI::RegisterImage(s);
   SDL_FreeSurface(s);
   return res;
 }
 
-void Draw()
+bool Draw()
 {
+  if (!RepaUI::NeedsRedraw())
+  {
+    return false;
+  }
+
   SDL_RenderClear(_renderer);
 
   RepaUI::Draw();
 
   SDL_RenderPresent(_renderer);
+
+  return true;
 }
 
 void HoverTest(RepaUI::Element* sender)
@@ -95,18 +101,18 @@ void CreateGUI()
   canvasBg->SetColor({ 32, 32, 32, 255 });
 
   auto img1 = RepaUI::CreateImage(canvas, { 0, 0, 100, 100 }, sliceImg);
-  img1->OnMouseOver = HoverTest;
-  img1->OnMouseOut  = OutTest;
+  img1->OnMouseOver().Connect(HoverTest);
+  img1->OnMouseOut().Connect(OutTest);
   img1->SetDrawType(RepaUI::Image::DrawType::NORMAL);
 
   auto img2 = RepaUI::CreateImage(canvas, { 150, 0, 100, 100 }, checkersImg);
-  img2->OnMouseOver = HoverTest;
-  img2->OnMouseOut  = OutTest;
+  img2->OnMouseOver().Connect(HoverTest);
+  img2->OnMouseOut().Connect(OutTest);
   img2->SetDrawType(RepaUI::Image::DrawType::TILED);
 
   auto img3 = RepaUI::CreateImage(canvas, { 0, 300, 300, 300 }, sliceImg);
-  img3->OnMouseOver = HoverTest;
-  img3->OnMouseOut  = OutTest;
+  img3->OnMouseOver().Connect(HoverTest);
+  img3->OnMouseOut().Connect(OutTest);
   //img3->SetSlicePoints({ 7, 7, 24, 24 });
   img3->SetSlicePoints({ 70, 70, 249, 249 });
   img3->SetDrawType(RepaUI::Image::DrawType::SLICED);
@@ -118,8 +124,8 @@ void CreateGUI()
   //canvasBg->SetColor({ 32, 0, 0, 255 });
 
   auto img4 = RepaUI::CreateImage(canvas3, { 50, 50, 100, 100 }, btnImg);
-  img4->OnMouseOver = HoverTest;
-  img4->OnMouseOut  = OutTest;
+  img4->OnMouseOver().Connect(HoverTest);
+  img4->OnMouseOut().Connect(OutTest);
   img4->SetSlicePoints({ 3, 3, 12, 12 });
   img4->SetDrawType(RepaUI::Image::DrawType::SLICED);
 
@@ -128,12 +134,12 @@ void CreateGUI()
   canvasBg->SetColor({ 0, 32, 0, 255 });
 
   auto img5 = RepaUI::CreateImage(canvas2, { 0, 0, 100, 100 }, sliceImg);
-  img5->OnMouseOver = HoverTest;
-  img5->OnMouseOut  = OutTest;
+  img5->OnMouseOver().Connect(HoverTest);
+  img5->OnMouseOut().Connect(OutTest);
 
   auto img6 = RepaUI::CreateImage(nullptr, { 550, 400, 50, 50 }, nullptr);
-  img6->OnMouseOver = HoverTest;
-  img6->OnMouseOut  = OutTest;
+  img6->OnMouseOver().Connect(HoverTest);
+  img6->OnMouseOut().Connect(OutTest);
   img6->SetColor({ 64, 64, 64, 255 });
 
   auto txt = RepaUI::CreateText(canvas2, { 0, 100, 400, 100 }, StrLeft);
@@ -152,10 +158,10 @@ void CreateGUI()
   btn2->SetEnabled(false);
 
   auto btn = RepaUI::CreateButton(canvas2, { 50, 400, 200, 50 }, "Click Me!");
-  btn->OnClicked = [btn2](RepaUI::Button* sender)
+  btn->OnClicked().Connect([btn2](RepaUI::Button* sender)
   {
     btn2->SetEnabled(!btn2->IsEnabled());
-  };
+  });
 
   elements.push_back(canvas);
   elements.push_back(canvas2);
@@ -337,7 +343,13 @@ int main(int argc, char* argv[])
       }
     }
 
-    Draw();
+    //
+    // Nothing changed, so sleep until something happens.
+    //
+    if (!Draw())
+    {
+      SDL_WaitEvent(nullptr);
+    }
   }
 
   SDL_Quit();
@@ -4,13 +4,38 @@
 #include "SDL2/SDL.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <memory>
 #include <map>
+#include <list>
 #include <stack>
 #include <functional>
+#include <type_traits>
+#include <utility>
+#include <new>
+
+//
+// SDL_RenderGeometry() is available since SDL 2.0.18,
+// older versions fall back to one SDL_RenderCopy() per quad.
+//
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define REPAUI_RENDER_GEOMETRY
+#endif
+
+//
+// Widest integer SIMD available at compile time,
+// element table falls back to plain loops without it.
+//
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define REPAUI_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REPAUI_SIMD_SSE2
+#endif
 
 namespace RepaUI
 {
@@ -32,12 +57,164 @@ namespace RepaUI
     return std::max(min, std::min(value, max));
   }
 
+  //
+  // Rect is unset only if all of its fields are zero,
+  // so e.g. rect starting at x = 0 still counts.
+  //
   bool IsSet(const SDL_Rect& rect)
   {
     return (rect.x != 0
-         && rect.y != 0
-         && rect.w != 0
-         && rect.h != 0);
+         || rect.y != 0
+         || rect.w != 0
+         || rect.h != 0);
+  }
+
+  bool Contains(const SDL_Rect& outer, const SDL_Rect& inner)
+  {
+    return (inner.x >= outer.x
+         && inner.y >= outer.y
+         && inner.x + inner.w <= outer.x + outer.w
+         && inner.y + inner.h <= outer.y + outer.h);
+  }
+
+  bool Touches(const SDL_Rect& a, const SDL_Rect& b)
+  {
+    return (a.x <= b.x + b.w
+         && b.x <= a.x + a.w
+         && a.y <= b.y + b.h
+         && b.y <= a.y + a.h);
+  }
+
+  //
+  // Appends to the list up to 4 rects that together cover
+  // the part of rect that lies outside of cut.
+  //
+  void SubtractRect(const SDL_Rect& rect,
+                    const SDL_Rect& cut,
+                    std::vector<SDL_Rect>& res)
+  {
+    SDL_Rect i;
+
+    if (!SDL_IntersectRect(&rect, &cut, &i))
+    {
+      res.push_back(rect);
+      return;
+    }
+
+    int rectR = rect.x + rect.w;
+    int rectB = rect.y + rect.h;
+    int iR    = i.x + i.w;
+    int iB    = i.y + i.h;
+
+    //
+    //  -----------
+    // |     0     |
+    //  --- --- ---
+    // | 2 | i | 3 |
+    //  --- --- ---
+    // |     1     |
+    //  -----------
+    //
+    if (i.y > rect.y)
+    {
+      res.push_back({ rect.x, rect.y, rect.w, i.y - rect.y });
+    }
+
+    if (iB < rectB)
+    {
+      res.push_back({ rect.x, iB, rect.w, rectB - iB });
+    }
+
+    if (i.x > rect.x)
+    {
+      res.push_back({ rect.x, i.y, i.x - rect.x, i.h });
+    }
+
+    if (iR < rectR)
+    {
+      res.push_back({ iR, i.y, rectR - iR, i.h });
+    }
+  }
+
+  //
+  // Joins rects that share the whole edge into one.
+  //
+  void MergeAdjacentRects(std::vector<SDL_Rect>& rects)
+  {
+    bool merged = true;
+    while (merged)
+    {
+      merged = false;
+
+      for (size_t i = 0; i < rects.size() && !merged; i++)
+      {
+        for (size_t j = i + 1; j < rects.size(); j++)
+        {
+          auto& a = rects[i];
+          auto& b = rects[j];
+
+          bool vertical = (a.x == b.x && a.w == b.w
+                       && (a.y + a.h == b.y || b.y + b.h == a.y));
+
+          bool horizontal = (a.y == b.y && a.h == b.h
+                         && (a.x + a.w == b.x || b.x + b.w == a.x));
+
+          if (vertical || horizontal)
+          {
+            SDL_UnionRect(&a, &b, &a);
+            rects.erase(rects.begin() + j);
+            merged = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  //
+  // Adds rect to the list of damaged areas, merging it with
+  // every rect that touches or overlaps it, so that no pixel
+  // gets redrawn twice during the same frame.
+  //
+  void AddDamagedRect(std::vector<SDL_Rect>& rects,
+                      SDL_Rect r,
+                      size_t maxRects)
+  {
+    bool merged = true;
+    while (merged)
+    {
+      merged = false;
+
+      for (auto it = rects.begin(); it != rects.end(); it++)
+      {
+        if (Touches(*it, r))
+        {
+          SDL_UnionRect(&r, &(*it), &r);
+          rects.erase(it);
+          merged = true;
+          break;
+        }
+      }
+    }
+
+    rects.push_back(r);
+
+    //
+    // Too many small rects cost more in clip changes
+    // and redraws of the same elements than just one big rect.
+    //
+    if (rects.size() > maxRects)
+    {
+      r = rects[0];
+
+      for (auto& dr : rects)
+      {
+        SDL_UnionRect(&r, &dr, &r);
+      }
+
+      rects.clear();
+      rects.push_back(r);
+    }
   }
 
 // =============================================================================
@@ -49,853 +226,3614 @@ namespace RepaUI
   class Text;
   class Button;
 // =============================================================================
-//                               MANAGER
+//                             TEXTURE ATLAS
 // =============================================================================
-  class Manager final
+  //
+  // Part of the atlas page that holds registered image.
+  //
+  struct ImageHandle
+  {
+    SDL_Texture* Texture = nullptr;
+    SDL_Rect Src = { 0, 0, 0, 0 };
+
+    //
+    // True if image has no transparent pixels.
+    //
+    bool Opaque = false;
+
+    bool IsValid() const
+    {
+      return (Texture != nullptr);
+    }
+  };
+
+  //
+  // Packs images into few big textures (pages) using shelf packing:
+  // every page is split into horizontal shelves, and image goes
+  // into the lowest shelf it fits into.
+  // New pages are added as needed.
+  //
+  class TextureAtlas final
   {
     public:
-      static Manager& Get()
+      void Init(SDL_Renderer* rendRef)
       {
-        static Manager instance;
-        return instance;
+        _rendRef = rendRef;
+
+        SDL_RendererInfo info;
+        if (SDL_GetRendererInfo(_rendRef, &info) == 0
+         && info.max_texture_width > 0
+         && info.max_texture_height > 0)
+        {
+          _pageSize = std::min(_pageSize, info.max_texture_width);
+          _pageSize = std::min(_pageSize, info.max_texture_height);
+        }
       }
 
-      void Init(SDL_Window* windowRef)
+      ImageHandle Add(SDL_Surface* surface)
       {
-        if (_initialized)
+        ImageHandle res;
+
+        if (surface == nullptr)
         {
-          return;
+          SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                       "Trying to add null surface to atlas!");
+          return res;
         }
 
-        _rendRef   = SDL_GetRenderer(windowRef);
-        _windowRef = windowRef;
-
-        SDL_GetWindowSize(_windowRef, &_windowWidth, &_windowHeight);
+        //
+        // Color key is converted to alpha here.
+        //
+        SDL_Surface* s = SDL_ConvertSurfaceFormat(surface,
+                                                  SDL_PIXELFORMAT_RGBA32,
+                                                  0);
+        if (s == nullptr)
+        {
+          SDL_Log("%s", SDL_GetError());
+          return res;
+        }
 
-        _renderTexture = CreateRenderTexture(_windowWidth * 3,
-                                             _windowHeight * 3);
+        Page* page = nullptr;
 
-        _renderTempTexture = CreateRenderTexture(_windowWidth,
-                                                 _windowHeight);
+        for (auto& p : _pages)
+        {
+          if (Allocate(p, s->w, s->h, res.Src))
+          {
+            page = &p;
+            break;
+          }
+        }
 
-        _renderDst =
+        if (page == nullptr)
         {
-          _windowWidth,
-          _windowHeight,
-          _windowWidth,
-          _windowHeight
-        };
+          //
+          // Images that are bigger than the page get their own one.
+          //
+          page = AddPage(std::max(_pageSize, s->w),
+                         std::max(_pageSize, s->h));
 
-        CreateScreenCanvas();
-        PrepareImages();
-        CutFontGlyphs();
+          if (page == nullptr || !Allocate(*page, s->w, s->h, res.Src))
+          {
+            SDL_FreeSurface(s);
+            return res;
+          }
+        }
 
-        _initialized = true;
+        SDL_UpdateTexture(page->Texture, &res.Src, s->pixels, s->pitch);
+
+        res.Texture = page->Texture;
+        res.Opaque  = IsOpaque(s);
+
+        SDL_FreeSurface(s);
+
+        return res;
       }
 
-      void HandleEvents(const SDL_Event& evt);
-      void Draw();
+    private:
+      bool IsOpaque(SDL_Surface* s)
+      {
+        bool res = true;
 
-      // =======================================================================
-      Canvas* CreateCanvas(const SDL_Rect& transform);
+        SDL_LockSurface(s);
 
-      Image* CreateImage(Canvas* canvas,
-                          const SDL_Rect& transform,
-                          SDL_Texture* image);
+        for (int y = 0; y < s->h && res; y++)
+        {
+          uint8_t* row = (uint8_t*)s->pixels + y * s->pitch;
 
-      Text* CreateText(Canvas* canvas,
-                       const SDL_Rect& transform,
-                       const std::string& text);
+          //
+          // RGBA32 is byte order, so alpha is always the last one.
+          //
+          for (int x = 0; x < s->w; x++)
+          {
+            if (row[x * 4 + 3] != 255)
+            {
+              res = false;
+              break;
+            }
+          }
+        }
 
-      Button* CreateButton(Canvas* canvas,
-                           const SDL_Rect& transform,
-                           const std::string& text);
-      // =======================================================================
+        SDL_UnlockSurface(s);
 
-    private:
-      struct GlyphInfo
+        return res;
+      }
+
+      struct Shelf
       {
-        int X;
         int Y;
+        int Height;
+        int X;
       };
 
-      void DrawToTexture();
-      void DrawOnScreen();
+      struct Page
+      {
+        SDL_Texture* Texture;
 
-      void ProcessCanvases(const SDL_Event& evt);
+        int W;
+        int H;
+        int NextShelfY;
 
-      const uint64_t& GetNewId()
-      {
-        _globalId++;
-        return _globalId;
-      }
+        std::vector<Shelf> Shelves;
+      };
 
-      void PrepareImages()
+      Page* AddPage(int w, int h)
       {
-        _blankImage = LoadImageFromBase64(_pixelImageBase64);
-        _font       = LoadImageFromBase64(_fontBase64, 255, 0, 255);
+        SDL_Texture* t = SDL_CreateTexture(_rendRef,
+                                           SDL_PIXELFORMAT_RGBA32,
+                                           SDL_TEXTUREACCESS_STATIC,
+                                           w,
+                                           h);
+        if (t == nullptr)
+        {
+          SDL_Log("%s", SDL_GetError());
+          return nullptr;
+        }
+
+        //
+        // Gaps between images must be transparent
+        // for linear filtering not to pick up garbage.
+        //
+        std::vector<uint32_t> empty(w * h, 0);
+        SDL_UpdateTexture(t, nullptr, empty.data(), w * sizeof(uint32_t));
+        SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
+
+        _pages.push_back({ t, w, h, 0, {} });
 
-        _btnNormal   = LoadImageFromBase64(_btnNormalBase64, 255, 0, 255);
-        _btnPressed  = LoadImageFromBase64(_btnPressedBase64, 255, 0, 255);
-        _btnHover    = LoadImageFromBase64(_btnHoverBase64, 255, 0, 255);
-        _btnDisabled = LoadImageFromBase64(_btnDisabledBase64, 255, 0, 255);
+        return &_pages.back();
       }
 
-      void CutFontGlyphs()
+      bool Allocate(Page& page, int w, int h, SDL_Rect& res)
       {
-        int startingChar = 32;
+        Shelf* best = nullptr;
 
-        for (int y = 0; y < FontSheetH; y += FontH)
+        for (auto& shelf : page.Shelves)
         {
-          for (int x = 0; x < FontSheetW; x += FontW)
+          if (h <= shelf.Height
+           && shelf.X + w <= page.W
+           && (best == nullptr || shelf.Height < best->Height))
           {
-            _fontDataByChar[startingChar] = { x, y };
-            startingChar++;
+            best = &shelf;
           }
         }
 
-        bool stop = false;
+        if (best == nullptr)
+        {
+          if (w > page.W || page.NextShelfY + h > page.H)
+          {
+            return false;
+          }
+
+          page.Shelves.push_back({ page.NextShelfY, h, 0 });
+          page.NextShelfY += h + Padding;
+
+          best = &page.Shelves.back();
+        }
+
+        res = { best->X, best->Y, w, h };
+
+        best->X += w + Padding;
+
+        return true;
       }
 
-      GlyphInfo* GetCharData(uint8_t ch)
+      SDL_Renderer* _rendRef = nullptr;
+
+      //
+      // List, so that pointers to pages stay valid.
+      //
+      std::list<Page> _pages;
+
+      int _pageSize = 1024;
+
+      const int Padding = 1;
+  };
+// =============================================================================
+//                             SPATIAL GRID
+// =============================================================================
+  //
+  // Uniform grid over [0, w] x [0, h] used for hit testing.
+  // Every cell keeps elements that overlap it in draw order,
+  // so the topmost one is always at the back.
+  //
+  class SpatialGrid final
+  {
+    public:
+      //
+      // Range of cells (inclusive) that element occupies.
+      //
+      struct CellRange
       {
-        GlyphInfo* res = nullptr;
+        int X0 = 0;
+        int Y0 = 0;
+        int X1 = -1;
+        int Y1 = -1;
 
-        if (_fontDataByChar.count(ch) == 1)
+        bool IsEmpty() const
         {
-          res = &_fontDataByChar.at(ch);
+          return (X1 < X0 || Y1 < Y0);
         }
-        else
+
+        bool operator==(const CellRange& other) const
         {
-          res = &_fontDataByChar.at('?');
+          return (X0 == other.X0
+               && Y0 == other.Y0
+               && X1 == other.X1
+               && Y1 == other.Y1);
         }
+      };
 
-        return res;
-      }
-
-      SDL_Texture* CreateRenderTexture(int w, int h)
+      //
+      // Clears the grid, so every element must be added again.
+      //
+      void Reset(int w, int h)
       {
-        return SDL_CreateTexture(_rendRef,
-                                 SDL_PIXELFORMAT_RGBA32,
-                                 SDL_TEXTUREACCESS_TARGET,
-                                 w,
-                                 h);
+        _w = std::max(w, 0);
+        _h = std::max(h, 0);
+
+        _cols = _w / CellSize + 1;
+        _rows = _h / CellSize + 1;
+
+        _cells.clear();
+        _cells.resize(_cols * _rows);
       }
 
-      SDL_Texture* LoadImage(const std::string& fname)
+      //
+      // Element outside of the grid can still be hit
+      // at the points outside of the grid,
+      // so such points must be checked some other way.
+      //
+      bool Contains(int x, int y)
       {
-        SDL_Texture* res = nullptr;
-        SDL_Surface* s = SDL_LoadBMP(fname.data());
-        if (s == nullptr)
-        {
-          SDL_Log("%s", SDL_GetError());
-        }
-        res = SDL_CreateTextureFromSurface(_rendRef, s);
-        SDL_FreeSurface(s);
-        return res;
+        return (x >= 0 && x <= _w && y >= 0 && y <= _h);
       }
 
-      SDL_Texture* LoadImage(const std::string& fname,
-                             uint8_t rMask,
-                             uint8_t gMask,
-                             uint8_t bMask)
+      void Update(Element* e, const SDL_Rect& rect, bool present);
+      void Remove(Element* e);
+
+      Element* Find(int x, int y, const SDL_Event& evt);
+
+      //
+      // Everything that can be hit anywhere in the cell
+      // the point falls into. Point must be inside of the grid.
+      //
+      const std::vector<Element*>& CellAt(int x, int y)
       {
-        SDL_Texture* res = nullptr;
-        SDL_Surface* s = SDL_LoadBMP(fname.data());
-        SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGB(s->format, rMask, gMask, bMask));
-        if (s == nullptr)
-        {
-          SDL_Log("%s", SDL_GetError());
-        }
-        res = SDL_CreateTextureFromSurface(_rendRef, s);
-        SDL_FreeSurface(s);
-        return res;
+        return Cell(x / CellSize, y / CellSize);
       }
 
-      SDL_Texture* LoadImageFromBase64(const std::string& base64Encoded)
+      //
+      // Bounds of that cell, cut to the grid size.
+      //
+      SDL_Rect CellRect(int x, int y)
       {
-        SDL_Texture* res = nullptr;
-        auto str = Base64_Decode(base64Encoded);
-        std::vector<unsigned char> bytes;
-        for (auto& c : str)
-        {
-            bytes.push_back(c);
-        }
-        SDL_RWops* data = SDL_RWFromMem(bytes.data(), bytes.size());
-        SDL_Surface* s = SDL_LoadBMP_RW(data, 1);
-        if (s == nullptr)
+        int x0 = (x / CellSize) * CellSize;
+        int y0 = (y / CellSize) * CellSize;
+
+        return
         {
-          SDL_Log("%s", SDL_GetError());
-        }
-        res = SDL_CreateTextureFromSurface(_rendRef, s);
-        SDL_FreeSurface(s);
-        return res;
+          x0,
+          y0,
+          std::min(CellSize, _w + 1 - x0),
+          std::min(CellSize, _h + 1 - y0)
+        };
       }
 
-      SDL_Texture* LoadImageFromBase64(const std::string& base64Encoded,
-                                       uint8_t rMask,
-                                       uint8_t gMask,
-                                       uint8_t bMask)
+    private:
+      CellRange CellsOf(const SDL_Rect& rect);
+
+      std::vector<Element*>& Cell(int x, int y)
       {
-        SDL_Texture* res = nullptr;
-        auto str = Base64_Decode(base64Encoded);
-        std::vector<unsigned char> bytes;
-        for (auto& c : str)
-        {
-            bytes.push_back(c);
-        }
-        SDL_RWops* data = SDL_RWFromMem(bytes.data(), bytes.size());
-        SDL_Surface* s = SDL_LoadBMP_RW(data, 1);
-        if (s == nullptr)
-        {
-          SDL_Log("%s", SDL_GetError());
-        }
-        SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGB(s->format, rMask, gMask, bMask));
-        res = SDL_CreateTextureFromSurface(_rendRef, s);
-        SDL_FreeSurface(s);
-        return res;
+        return _cells[y * _cols + x];
       }
 
-      void PushClipRect()
+      std::vector<std::vector<Element*>> _cells;
+
+      int _w    = 0;
+      int _h    = 0;
+      int _cols = 0;
+      int _rows = 0;
+
+      const int CellSize = 64;
+  };
+
+// =============================================================================
+//                             ELEMENT TABLE
+// =============================================================================
+  //
+  // Copy of data that is read for every element of a canvas
+  // on each hit test and each redraw, kept in draw order
+  // as separate arrays so that several elements
+  // are checked with one instruction.
+  //
+  class ElementTable final
+  {
+    public:
+      void Update(Element* e);
+      void Remove(Element* e);
+
+      Element* At(int index)
       {
-        SDL_RenderGetClipRect(_rendRef, &_currentClipRect);
-        _renderClipRects.push(_currentClipRect);
+        return _elements[index];
       }
 
-      void PopClipRect()
+      SDL_Rect DrawBounds(int index)
       {
-        if (!_renderClipRects.empty())
+        return
         {
-          _currentClipRect = _renderClipRects.top();
-          _renderClipRects.pop();
+          _drawX0[index],
+          _drawY0[index],
+          _drawX1[index] - _drawX0[index],
+          _drawY1[index] - _drawY0[index]
+        };
+      }
 
-          if (!IsSet(_currentClipRect))
-          {
-            SDL_RenderSetClipRect(_rendRef, nullptr);
-          }
-          else
-          {
-            SDL_RenderSetClipRect(_rendRef, &_currentClipRect);
-          }
+      //
+      // Topmost enabled and visible element
+      // which rect (edges included) contains the point.
+      //
+      Element* Find(int x, int y);
+
+      //
+      // Indices of visible elements which draw bounds
+      // intersect clip, topmost first.
+      //
+      void Cull(const SDL_Rect& clip, std::vector<int>& res);
+
+    private:
+      bool IsHit(int index, int x, int y)
+      {
+        return (_hittable[index] != 0
+             && x >= _hitX0[index]
+             && x <= _hitX1[index]
+             && y >= _hitY0[index]
+             && y <= _hitY1[index]);
+      }
+
+      bool IsDrawn(int index, const SDL_Rect& clip)
+      {
+        return (_visible[index] != 0
+             && _drawX1[index] > _drawX0[index]
+             && _drawY1[index] > _drawY0[index]
+             && _drawX0[index] < clip.x + clip.w
+             && _drawX1[index] > clip.x
+             && _drawY0[index] < clip.y + clip.h
+             && _drawY1[index] > clip.y);
+      }
+
+      static int HighestBit(int mask)
+      {
+        int res = 0;
+
+        while (mask > 1)
+        {
+          mask >>= 1;
+          res++;
         }
+
+        return res;
       }
 
-      std::string Base64_Decode(const std::string& encoded_string)
+      std::vector<Element*> _elements;
+
+      //
+      // Rects in owner's coordinates, right and bottom edges included.
+      //
+      std::vector<int32_t> _hitX0;
+      std::vector<int32_t> _hitY0;
+      std::vector<int32_t> _hitX1;
+      std::vector<int32_t> _hitY1;
+
+      //
+      // Draw bounds in layer coordinates, right and bottom edges excluded.
+      //
+      std::vector<int32_t> _drawX0;
+      std::vector<int32_t> _drawY0;
+      std::vector<int32_t> _drawX1;
+      std::vector<int32_t> _drawY1;
+
+      //
+      // All bits set if true, so they're used as masks as is.
+      //
+      std::vector<int32_t> _hittable;
+      std::vector<int32_t> _visible;
+  };
+// =============================================================================
+//                               SLOT MAP
+// =============================================================================
+  //
+  // Reference to element or canvas that stays safe to keep
+  // after the object is gone: it just stops resolving,
+  // even if the slot is reused by a newer object.
+  //
+  struct ElementHandle
+  {
+    uint32_t Index      = 0;
+    uint32_t Generation = 0;
+
+    bool IsValid() const
+    {
+      return (Generation != 0);
+    }
+
+    bool operator==(const ElementHandle& other) const
+    {
+      return (Index == other.Index
+           && Generation == other.Generation);
+    }
+
+    bool operator!=(const ElementHandle& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  //
+  // Objects are owned by a contiguous array kept in id order,
+  // which is also the draw order, while handles point to slots
+  // that know where in that array the object currently is.
+  //
+  template <typename T>
+  class SlotMap final
+  {
+    public:
+      using Storage = std::vector<std::unique_ptr<T>>;
+
+      ElementHandle Insert(T* obj)
       {
-        int in_len = encoded_string.size();
-        int i = 0;
-        int j = 0;
-        int in_ = 0;
-        unsigned char char_array_4[4], char_array_3[3];
-        std::string ret;
+        ElementHandle res;
 
-        while (in_len-- && ( encoded_string[in_] != '=') && IsBase64(encoded_string[in_]))
+        if (_freeSlots.empty())
         {
-          char_array_4[i++] = encoded_string[in_]; in_++;
-          if (i ==4)
-          {
-            for (i = 0; i <4; i++)
-            {
-              char_array_4[i] = _base64Chars.find(char_array_4[i]);
-            }
+          res.Index = (uint32_t)_slots.size();
+          _slots.push_back(Slot());
+        }
+        else
+        {
+          res.Index = _freeSlots.back();
+          _freeSlots.pop_back();
+        }
 
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+        Slot& slot = _slots[res.Index];
 
-            for (i = 0; (i < 3); i++)
-            {
-              ret += char_array_3[i];
-            }
+        //
+        // Zero generation is reserved for invalid handles.
+        //
+        slot.Generation++;
 
-            i = 0;
-          }
+        if (slot.Generation == 0)
+        {
+          slot.Generation++;
         }
 
-        if (i)
+        res.Generation = slot.Generation;
+
+        auto byId = [](const std::unique_ptr<T>& a, T* b)
         {
-          for (j = i; j <4; j++)
-          {
-            char_array_4[j] = 0;
-          }
+          return (a->Id() < b->Id());
+        };
 
-          for (j = 0; j <4; j++)
-          {
-            char_array_4[j] = _base64Chars.find(char_array_4[j]);
-          }
+        auto it = std::lower_bound(_objects.begin(), _objects.end(), obj, byId);
 
-          char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-          char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-          char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+        size_t pos = it - _objects.begin();
 
-          for (j = 0; (j < i - 1); j++)
-          {
-            ret += char_array_3[j];
-          }
-        }
+        _objects.emplace(it, obj);
+        _slotOf.insert(_slotOf.begin() + pos, res.Index);
 
-        return ret;
+        UpdateSlots(pos);
+
+        return res;
       }
 
-      bool IsBase64(unsigned char c)
+      //
+      // Slot goes to the free list, ownership goes to the caller.
+      //
+      std::unique_ptr<T> Remove(const ElementHandle& h)
       {
-        auto res = std::find(_base64Chars.begin(),
-                             _base64Chars.end(),
-                             c);
+        if (Get(h) == nullptr)
+        {
+          return nullptr;
+        }
 
-        return (res != _base64Chars.end());
-      }
+        Slot& slot = _slots[h.Index];
 
-      void CreateScreenCanvas();
+        size_t pos = slot.Dense;
 
-      SDL_Renderer* _rendRef = nullptr;
-      SDL_Window* _windowRef = nullptr;
+        std::unique_ptr<T> res = std::move(_objects[pos]);
 
-      SDL_Texture* _font       = nullptr;
-      SDL_Texture* _blankImage = nullptr;
+        _objects.erase(_objects.begin() + pos);
+        _slotOf.erase(_slotOf.begin() + pos);
 
-      SDL_Texture* _btnNormal   = nullptr;
-      SDL_Texture* _btnPressed  = nullptr;
-      SDL_Texture* _btnHover    = nullptr;
-      SDL_Texture* _btnDisabled = nullptr;
+        UpdateSlots(pos);
 
-      SDL_Texture* _renderTexture     = nullptr;
-      SDL_Texture* _renderTempTexture = nullptr;
+        //
+        // Old handles must not resolve to whatever takes this slot next.
+        //
+        slot.Generation++;
 
-      SDL_Color _oldRenderColor;
+        _freeSlots.push_back(h.Index);
 
-      SDL_Rect _renderDst;
+        return res;
+      }
 
-      bool _initialized = false;
+      T* Get(const ElementHandle& h)
+      {
+        if (!h.IsValid()
+         || h.Index >= _slots.size()
+         || _slots[h.Index].Generation != h.Generation)
+        {
+          return nullptr;
+        }
 
-      int _windowWidth  = 0;
-      int _windowHeight = 0;
+        return _objects[_slots[h.Index].Dense].get();
+      }
 
-      const uint8_t FontW = 8;
-      const uint8_t FontH = 16;
-      const uint8_t FontSheetW = 128;
-      const uint8_t FontSheetH = 96;
+      size_t Size()
+      {
+        return _objects.size();
+      }
 
-      uint64_t _globalId = 0;
+      typename Storage::iterator begin()
+      {
+        return _objects.begin();
+      }
 
-      std::map<uint64_t, std::unique_ptr<Canvas>> _canvases;
-      std::map<uint8_t, GlyphInfo> _fontDataByChar;
+      typename Storage::iterator end()
+      {
+        return _objects.end();
+      }
 
-      std::unique_ptr<Canvas> _screenCanvas;
+      typename Storage::reverse_iterator rbegin()
+      {
+        return _objects.rbegin();
+      }
 
-      Canvas* _topCanvas = nullptr;
+      typename Storage::reverse_iterator rend()
+      {
+        return _objects.rend();
+      }
 
-      SDL_Rect _currentClipRect;
+    private:
+      struct Slot
+      {
+        uint32_t Dense      = 0;
+        uint32_t Generation = 0;
+      };
 
-      std::stack<SDL_Rect> _renderClipRects;
+      void UpdateSlots(size_t from)
+      {
+        for (size_t i = from; i < _objects.size(); i++)
+        {
+          _slots[_slotOf[i]].Dense = (uint32_t)i;
+        }
+      }
 
-      const static std::string _base64Chars;
-      const static std::string _fontBase64;
-      const static std::string _pixelImageBase64;
+      Storage _objects;
 
-      const static std::string _btnNormalBase64;
-      const static std::string _btnPressedBase64;
-      const static std::string _btnHoverBase64;
-      const static std::string _btnDisabledBase64;
+      //
+      // Slot of each object in _objects.
+      //
+      std::vector<uint32_t> _slotOf;
 
-      friend class Element;
-      friend class Canvas;
-      friend class Image;
-      friend class Text;
-      friend class Button;
+      std::vector<Slot>     _slots;
+      std::vector<uint32_t> _freeSlots;
   };
 
 // =============================================================================
-//                              BASE WIDGET CLASS
+//                               SIGNALS
 // =============================================================================
-  class Element
+  //
+  // Callable that is stored right inside the object
+  // if it's small enough (functions, lambdas capturing a few pointers),
+  // so connecting a handler usually doesn't allocate anything.
+  //
+  template <typename... Args>
+  class Delegate final
   {
     public:
-      Element(Canvas* parent,
-              const SDL_Rect& transform);
+      Delegate() = default;
 
-      void SetEnabled(bool enabled)
+      template <typename F,
+                typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, Delegate>::value
+                >::type>
+      Delegate(F&& fn)
       {
-        _enabled = enabled;
+        using T = typename std::decay<F>::type;
 
-        if (!_enabled)
+        Store<T>(std::forward<F>(fn),
+                 std::integral_constant<bool, IsInPlace<T>()>());
+      }
+
+      Delegate(Delegate&& other) noexcept
+      {
+        MoveFrom(other);
+      }
+
+      Delegate& operator=(Delegate&& other) noexcept
+      {
+        if (this != &other)
         {
-          _mouseEnter = false;
+          Reset();
+          MoveFrom(other);
         }
+
+        return *this;
       }
 
-      bool IsEnabled()
+      Delegate(const Delegate&) = delete;
+      Delegate& operator=(const Delegate&) = delete;
+
+      ~Delegate()
       {
-        return _enabled;
+        Reset();
       }
 
-      void SetVisible(bool visible)
+      void Reset()
       {
-        _visible = visible;
-
-        if (!_visible)
+        if (_manage != nullptr)
         {
-          _mouseEnter = false;
+          _manage(Operation::DESTROY, _buffer, nullptr);
         }
+
+        _invoke = nullptr;
+        _manage = nullptr;
       }
 
-      bool IsVisible()
+      explicit operator bool() const
       {
-        return _visible;
+        return (_invoke != nullptr);
       }
 
-      bool IsEnabledAndVisible()
+      void operator()(Args... args)
       {
-        return (_enabled && _visible);
+        _invoke(_buffer, args...);
       }
 
-      void ShowOutline(bool value)
+    private:
+      enum class Operation
       {
-        _showOutline = value;
+        MOVE = 0,
+        DESTROY
+      };
+
+      template <typename T>
+      static constexpr bool IsInPlace()
+      {
+        return (sizeof(T) <= BufferSize
+             && alignof(T) <= alignof(void*)
+             && std::is_nothrow_move_constructible<T>::value);
       }
 
-      const uint64_t& Id()
+      template <typename T, typename F>
+      void Store(F&& fn, std::true_type)
       {
-        return _id;
+        new (_buffer) T(std::forward<F>(fn));
+
+        _invoke = &InvokeInPlace<T>;
+        _manage = &ManageInPlace<T>;
       }
 
-      const SDL_Rect& Transform()
+      template <typename T, typename F>
+      void Store(F&& fn, std::false_type)
       {
-        return (_owner == nullptr) ? _transform : _localTransform;
+        *reinterpret_cast<T**>(_buffer) = new T(std::forward<F>(fn));
+
+        _invoke = &InvokeOnHeap<T>;
+        _manage = &ManageOnHeap<T>;
       }
 
-      const SDL_Rect& GetCornersCoordsAbsolute()
+      template <typename T>
+      static void InvokeInPlace(void* buffer, Args... args)
       {
-        _corners.x = _renderTransform.x;
-        _corners.y = _renderTransform.y;
-        _corners.w = _renderTransform.x + _renderTransform.w;
-        _corners.h = _renderTransform.y + _renderTransform.h;
+        (*static_cast<T*>(buffer))(args...);
+      }
 
-        return _corners;
+      template <typename T>
+      static void InvokeOnHeap(void* buffer, Args... args)
+      {
+        (**static_cast<T**>(buffer))(args...);
       }
 
-      virtual void SetTransform(const SDL_Rect& transform);
+      template <typename T>
+      static void ManageInPlace(Operation op, void* dst, void* src)
+      {
+        if (op == Operation::MOVE)
+        {
+          new (dst) T(std::move(*static_cast<T*>(src)));
+        }
 
-      void HandleEvents(const SDL_Event& evt)
+        static_cast<T*>(src != nullptr ? src : dst)->~T();
+      }
+
+      template <typename T>
+      static void ManageOnHeap(Operation op, void* dst, void* src)
       {
-        if (!_enabled || !_visible)
+        if (op == Operation::MOVE)
         {
-          return;
+          *static_cast<T**>(dst) = *static_cast<T**>(src);
         }
+        else
+        {
+          delete *static_cast<T**>(dst);
+        }
+      }
 
-        switch (evt.type)
+      //
+      // Moved-from callable is destroyed right away,
+      // so the other delegate ends up empty.
+      //
+      void MoveFrom(Delegate& other)
+      {
+        if (other._manage != nullptr)
         {
-          case SDL_MOUSEMOTION:
-          {
-            if (IsMouseInside(evt))
-            {
-              if (!_mouseEnter)
-              {
+          other._manage(Operation::MOVE, _buffer, other._buffer);
+        }
+
+        _invoke = other._invoke;
+        _manage = other._manage;
+
+        other._invoke = nullptr;
+        other._manage = nullptr;
+      }
+
+      //
+      // Same size as std::function, anything bigger
+      // or with stricter alignment goes to the heap.
+      //
+      static const size_t BufferSize = 2 * sizeof(void*);
+
+      alignas(void*) unsigned char _buffer[BufferSize];
+
+      void (*_invoke)(void*, Args...) = nullptr;
+      void (*_manage)(Operation, void*, void*) = nullptr;
+  };
+
+  //
+  // Identifies subscriber. Ids are unique across all signals,
+  // so disconnecting from the wrong signal does nothing.
+  //
+  struct Connection
+  {
+    uint32_t Id = 0;
+
+    bool IsValid() const
+    {
+      return (Id != 0);
+    }
+
+    static uint32_t NewId()
+    {
+      static uint32_t lastId = 0;
+
+      lastId++;
+
+      //
+      // Zero is reserved for invalid connection.
+      //
+      if (lastId == 0)
+      {
+        lastId++;
+      }
+
+      return lastId;
+    }
+  };
+
+  //
+  // List of subscribers called in the order they were connected.
+  // It's safe to connect and disconnect from inside a handler:
+  // handlers connected while emitting are first called next time,
+  // disconnected ones are removed when emitting is done.
+  // Handler isn't called again if it emits the same signal itself.
+  //
+  template <typename... Args>
+  class Signal final
+  {
+    public:
+      Connection Connect(Delegate<Args...> fn)
+      {
+        Connection res;
+
+        if (!fn)
+        {
+          return res;
+        }
+
+        res.Id = Connection::NewId();
+
+        _slots.push_back({ res.Id, std::move(fn) });
+
+        _count++;
+
+        return res;
+      }
+
+      void Disconnect(const Connection& c)
+      {
+        if (!c.IsValid())
+        {
+          return;
+        }
+
+        for (auto it = _slots.begin(); it != _slots.end(); it++)
+        {
+          if (it->Id != c.Id)
+          {
+            continue;
+          }
+
+          //
+          // Emit() relies on indices staying the same,
+          // so while emitting handler is only marked
+          // and removed afterwards.
+          //
+          if (_emitting > 0)
+          {
+            it->Id = 0;
+          }
+          else
+          {
+            _slots.erase(it);
+          }
+
+          _count--;
+
+          return;
+        }
+      }
+
+      void DisconnectAll()
+      {
+        if (_emitting > 0)
+        {
+          for (auto& s : _slots)
+          {
+            s.Id = 0;
+          }
+        }
+        else
+        {
+          _slots.clear();
+        }
+
+        _count = 0;
+      }
+
+      bool IsEmpty() const
+      {
+        return (_count == 0);
+      }
+
+      void Emit(Args... args)
+      {
+        //
+        // Anything connected from now on is appended after this.
+        //
+        size_t end = _slots.size();
+
+        _emitting++;
+
+        for (size_t i = 0; i < end; i++)
+        {
+          if (_slots[i].Id == 0 || !_slots[i].Fn)
+          {
+            continue;
+          }
+
+          //
+          // Connecting may reallocate _slots,
+          // so the handler is moved out while it runs.
+          //
+          Delegate<Args...> fn = std::move(_slots[i].Fn);
+
+          fn(args...);
+
+          _slots[i].Fn = std::move(fn);
+        }
+
+        _emitting--;
+
+        if (_emitting == 0)
+        {
+          RemoveDisconnected();
+        }
+      }
+
+    private:
+      struct Slot
+      {
+        uint32_t Id;
+        Delegate<Args...> Fn;
+      };
+
+      void RemoveDisconnected()
+      {
+        _slots.erase(std::remove_if(_slots.begin(),
+                                    _slots.end(),
+                                    [](const Slot& s) { return (s.Id == 0); }),
+                     _slots.end());
+      }
+
+      std::vector<Slot> _slots;
+
+      uint32_t _count    = 0;
+      uint32_t _emitting = 0;
+  };
+
+// =============================================================================
+//                             RENDER STATE
+// =============================================================================
+  //
+  // Shadow copy of renderer and texture state,
+  // so that SDL is called only when value actually changes.
+  //
+  class RenderState final
+  {
+    public:
+      void Init(SDL_Renderer* rendRef)
+      {
+        _rendRef = rendRef;
+      }
+
+      //
+      // Application can change renderer state between frames,
+      // so everything is considered unknown at the start of the frame.
+      //
+      void Reset()
+      {
+        _targetKnown    = false;
+        _clipKnown      = false;
+        _drawColorKnown = false;
+
+        _drawBlendMode = SDL_BLENDMODE_INVALID;
+
+        _textures.clear();
+      }
+
+      SDL_Texture* GetRenderTarget()
+      {
+        if (!_targetKnown)
+        {
+          _target      = SDL_GetRenderTarget(_rendRef);
+          _targetKnown = true;
+        }
+
+        return _target;
+      }
+
+      void SetRenderTarget(SDL_Texture* target)
+      {
+        if (_targetKnown && _target == target)
+        {
+          return;
+        }
+
+        SDL_SetRenderTarget(_rendRef, target);
+
+        _target      = target;
+        _targetKnown = true;
+
+        //
+        // SDL resets clip rect on target change.
+        //
+        _clipKnown = false;
+      }
+
+      void SetClipRect(const SDL_Rect* clip)
+      {
+        if (_clipKnown)
+        {
+          if (clip == nullptr && !_clipEnabled)
+          {
+            return;
+          }
+
+          if (clip != nullptr && _clipEnabled && SDL_RectEquals(clip, &_clip))
+          {
+            return;
+          }
+        }
+
+        SDL_RenderSetClipRect(_rendRef, clip);
+
+        _clip        = (clip == nullptr) ? SDL_Rect { 0, 0, 0, 0 } : *clip;
+        _clipEnabled = (clip != nullptr);
+        _clipKnown   = true;
+      }
+
+      const SDL_Color& GetDrawColor()
+      {
+        if (!_drawColorKnown)
+        {
+          SDL_GetRenderDrawColor(_rendRef,
+                                 &_drawColor.r,
+                                 &_drawColor.g,
+                                 &_drawColor.b,
+                                 &_drawColor.a);
+          _drawColorKnown = true;
+        }
+
+        return _drawColor;
+      }
+
+      void SetDrawColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+      {
+        if (_drawColorKnown
+         && _drawColor.r == r
+         && _drawColor.g == g
+         && _drawColor.b == b
+         && _drawColor.a == a)
+        {
+          return;
+        }
+
+        SDL_SetRenderDrawColor(_rendRef, r, g, b, a);
+
+        _drawColor      = { r, g, b, a };
+        _drawColorKnown = true;
+      }
+
+      SDL_BlendMode GetDrawBlendMode()
+      {
+        if (_drawBlendMode == SDL_BLENDMODE_INVALID)
+        {
+          SDL_GetRenderDrawBlendMode(_rendRef, &_drawBlendMode);
+        }
+
+        return _drawBlendMode;
+      }
+
+      void SetDrawBlendMode(SDL_BlendMode mode)
+      {
+        if (_drawBlendMode == mode)
+        {
+          return;
+        }
+
+        SDL_SetRenderDrawBlendMode(_rendRef, mode);
+
+        _drawBlendMode = mode;
+      }
+
+      void SetTextureBlendMode(SDL_Texture* t, SDL_BlendMode mode)
+      {
+        if (t == nullptr)
+        {
+          return;
+        }
+
+        auto& ts = _textures[t];
+
+        if (ts.BlendMode == mode)
+        {
+          return;
+        }
+
+        SDL_SetTextureBlendMode(t, mode);
+
+        ts.BlendMode = mode;
+      }
+
+      void SetTextureColorMod(SDL_Texture* t, uint8_t r, uint8_t g, uint8_t b)
+      {
+        if (t == nullptr)
+        {
+          return;
+        }
+
+        auto& ts = _textures[t];
+
+        if (ts.R == r && ts.G == g && ts.B == b)
+        {
+          return;
+        }
+
+        SDL_SetTextureColorMod(t, r, g, b);
+
+        ts.R = r;
+        ts.G = g;
+        ts.B = b;
+      }
+
+      void SetTextureAlphaMod(SDL_Texture* t, uint8_t a)
+      {
+        if (t == nullptr)
+        {
+          return;
+        }
+
+        auto& ts = _textures[t];
+
+        if (ts.A == a)
+        {
+          return;
+        }
+
+        SDL_SetTextureAlphaMod(t, a);
+
+        ts.A = a;
+      }
+
+      //
+      // Must be called before texture is destroyed,
+      // since new texture may get the same address.
+      //
+      void Forget(SDL_Texture* t)
+      {
+        _textures.erase(t);
+
+        if (_target == t)
+        {
+          _targetKnown = false;
+        }
+      }
+
+    private:
+      //
+      // Negative values mean state is unknown.
+      //
+      struct TextureState
+      {
+        SDL_BlendMode BlendMode = SDL_BLENDMODE_INVALID;
+
+        int R = -1;
+        int G = -1;
+        int B = -1;
+        int A = -1;
+      };
+
+      SDL_Renderer* _rendRef = nullptr;
+
+      SDL_Texture* _target = nullptr;
+
+      SDL_Rect _clip = { 0, 0, 0, 0 };
+
+      SDL_Color _drawColor = { 0, 0, 0, 0 };
+
+      SDL_BlendMode _drawBlendMode = SDL_BLENDMODE_INVALID;
+
+      bool _targetKnown    = false;
+      bool _clipKnown      = false;
+      bool _clipEnabled    = false;
+      bool _drawColorKnown = false;
+
+      std::map<SDL_Texture*, TextureState> _textures;
+  };
+// =============================================================================
+//                              OBJECT POOL
+// =============================================================================
+  //
+  // Hands out blocks of the same size carved from big chunks,
+  // so objects of one type end up next to each other
+  // and creating lots of them takes only a few allocations.
+  // Chunks are kept until pool is gone, freed blocks are reused.
+  //
+  class ObjectPool final
+  {
+    public:
+      explicit ObjectPool(size_t blockSize)
+      {
+        size_t unit = sizeof(std::max_align_t);
+
+        _unitsPerBlock = (blockSize + unit - 1) / unit;
+      }
+
+      void* Allocate()
+      {
+        if (_free.empty())
+        {
+          AddChunk();
+        }
+
+        void* res = _free.back();
+        _free.pop_back();
+
+        return res;
+      }
+
+      void Free(void* p)
+      {
+        _free.push_back(p);
+      }
+
+    private:
+      //
+      // Every chunk is as big as all previous ones together,
+      // so number of allocations grows only logarithmically.
+      //
+      void AddChunk()
+      {
+        size_t blocks = Clamp(_blocksTotal, MinChunkBlocks, MaxChunkBlocks);
+
+        std::max_align_t* chunk = new std::max_align_t[blocks * _unitsPerBlock];
+
+        _chunks.emplace_back(chunk);
+
+        _blocksTotal += blocks;
+
+        //
+        // Reversed, so that blocks are handed out in address order.
+        //
+        for (size_t i = blocks; i > 0; i--)
+        {
+          _free.push_back(chunk + (i - 1) * _unitsPerBlock);
+        }
+      }
+
+      std::vector<std::unique_ptr<std::max_align_t[]>> _chunks;
+      std::vector<void*> _free;
+
+      size_t _unitsPerBlock = 0;
+      size_t _blocksTotal   = 0;
+
+      const size_t MinChunkBlocks = 32;
+      const size_t MaxChunkBlocks = 1024;
+  };
+// =============================================================================
+//                              MOTION AREA
+// =============================================================================
+  //
+  // Rectangle (edges included) around the last mouse position
+  // where moving the mouse can't change which elements
+  // the mouse is inside of.
+  //
+  struct MotionArea
+  {
+    int X0 = 0;
+    int Y0 = 0;
+    int X1 = -1;
+    int Y1 = -1;
+
+    static MotionArea Everything()
+    {
+      return { SDL_MIN_SINT32, SDL_MIN_SINT32, SDL_MAX_SINT32, SDL_MAX_SINT32 };
+    }
+
+    bool Contains(int x, int y) const
+    {
+      return (x >= X0 && x <= X1 && y >= Y0 && y <= Y1);
+    }
+
+    //
+    // Rect with usual meaning, right and bottom edges excluded.
+    //
+    void Intersect(const SDL_Rect& r)
+    {
+      X0 = std::max(X0, r.x);
+      Y0 = std::max(Y0, r.y);
+      X1 = std::min(X1, r.x + r.w - 1);
+      Y1 = std::min(Y1, r.y + r.h - 1);
+    }
+
+    //
+    // Shrinks area so that the point (x, y) stays
+    // either inside of the rect or outside of it,
+    // rect edges included, like in mouse checks.
+    //
+    void Separate(int x, int y, const SDL_Rect& r)
+    {
+      int x1 = r.x + r.w;
+      int y1 = r.y + r.h;
+
+      if (x < r.x)
+      {
+        X1 = std::min(X1, r.x - 1);
+      }
+      else if (x > x1)
+      {
+        X0 = std::max(X0, x1 + 1);
+      }
+      else if (y < r.y)
+      {
+        Y1 = std::min(Y1, r.y - 1);
+      }
+      else if (y > y1)
+      {
+        Y0 = std::max(Y0, y1 + 1);
+      }
+      else
+      {
+        X0 = std::max(X0, r.x);
+        Y0 = std::max(Y0, r.y);
+        X1 = std::min(X1, x1);
+        Y1 = std::min(Y1, y1);
+      }
+    }
+
+    //
+    // Same for half-plane of points with x not less than border.
+    //
+    void SeparateX(int x, int border)
+    {
+      if (x < border)
+      {
+        X1 = std::min(X1, border - 1);
+      }
+      else
+      {
+        X0 = std::max(X0, border);
+      }
+    }
+  };
+
+// =============================================================================
+//                               MANAGER
+// =============================================================================
+  class Manager final
+  {
+    public:
+      static Manager& Get()
+      {
+        static Manager instance;
+        return instance;
+      }
+
+      void Init(SDL_Window* windowRef)
+      {
+        if (_initialized)
+        {
+          return;
+        }
+
+        _rendRef   = SDL_GetRenderer(windowRef);
+        _windowRef = windowRef;
+        _windowId  = SDL_GetWindowID(windowRef);
+
+        _renderState.Init(_rendRef);
+
+        //
+        // Elements are blended into transparent layer,
+        // so its colors are already multiplied by alpha
+        // and must not be multiplied again when composed.
+        //
+        _layerBlendMode = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE,
+                                                     SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                                     SDL_BLENDOPERATION_ADD,
+                                                     SDL_BLENDFACTOR_ONE,
+                                                     SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                                     SDL_BLENDOPERATION_ADD);
+
+        SDL_GetWindowSize(_windowRef, &_windowWidth, &_windowHeight);
+
+        //
+        // Elements are drawn into their canvas' layer,
+        // which is clipped by its own bounds,
+        // and layers are composed with clipping against the window,
+        // so there's no need for any space around the screen
+        // to put overhanging parts into.
+        //
+        _renderTexture = CreateRenderTexture(_windowWidth,
+                                             _windowHeight);
+
+        _renderDst =
+        {
+          0,
+          0,
+          _windowWidth,
+          _windowHeight
+        };
+
+        _canvasesGrid.Reset(_windowWidth, _windowHeight);
+
+        CreateScreenCanvas();
+        PrepareImages();
+        CutFontGlyphs();
+
+        DamageAll();
+
+        _initialized = true;
+      }
+
+      void HandleEvents(const SDL_Event& evt);
+
+      //
+      // Same as calling HandleEvents() for every event,
+      // but with motion coalescing enabled, each run
+      // of consecutive motion events is handled as one.
+      //
+      void HandleEventBatch(const SDL_Event* events, size_t count);
+
+      //
+      // Off by default, since handlers then only see
+      // the last position of each run, and elements passed over
+      // in between don't get any events at all.
+      //
+      void SetMotionCoalescing(bool enabled)
+      {
+        _coalesceMotion = enabled;
+      }
+
+      //
+      // Installs SDL event filter that drops motion events
+      // which can't change what's under the mouse
+      // and can't reach any OnMouseMove() handler,
+      // so they're never queued. Application won't see them either.
+      // Previously installed filter is still called first.
+      // Off by default. Note that SDL discards all pending events
+      // whenever event filter is changed.
+      //
+      void SetMotionFilter(bool enabled);
+
+      //
+      // Called whenever anything that affects hit testing changes,
+      // so that filter lets next motion event through.
+      //
+      void InvalidateMotionArea()
+      {
+        if (!_motionFilter)
+        {
+          return;
+        }
+
+        SDL_AtomicLock(&_motionLock);
+        _motionArea = MotionArea();
+        SDL_AtomicUnlock(&_motionLock);
+      }
+
+      //
+      // Returns false if nothing has changed since last call,
+      // in which case nothing is drawn at all
+      // and previously presented frame is still valid.
+      //
+      bool Draw();
+
+      bool NeedsRedraw()
+      {
+        return _redrawRequested;
+      }
+
+      //
+      // For when application needs to redraw the screen
+      // for its own reasons.
+      //
+      void RequestRedraw()
+      {
+        _redrawRequested = true;
+      }
+
+      // =======================================================================
+      Canvas* CreateCanvas(const SDL_Rect& transform);
+
+      Image* CreateImage(Canvas* canvas,
+                          const SDL_Rect& transform,
+                          SDL_Texture* image);
+
+      Image* CreateImage(Canvas* canvas,
+                         const SDL_Rect& transform,
+                         SDL_Texture* image,
+                         const SDL_Rect& imageSrc);
+
+      Image* CreateImage(Canvas* canvas,
+                         const SDL_Rect& transform,
+                         const ImageHandle& image);
+
+      //
+      // Puts copy of the surface into texture atlas,
+      // surface itself can be freed afterwards.
+      //
+      ImageHandle RegisterImage(SDL_Surface* surface)
+      {
+        return _textureAtlas.Add(surface);
+      }
+
+      Text* CreateText(Canvas* canvas,
+                       const SDL_Rect& transform,
+                       const std::string& text);
+
+      Button* CreateButton(Canvas* canvas,
+                           const SDL_Rect& transform,
+                           const std::string& text);
+
+      //
+      // Null if handle is invalid or refers to something
+      // that doesn't exist anymore.
+      //
+      Canvas* GetCanvas(const ElementHandle& handle)
+      {
+        return _canvases.Get(handle);
+      }
+
+      //
+      // Objects are unlinked immediately, so it's safe
+      // to destroy them from their own event handlers,
+      // but memory is freed on next HandleEvents() or Draw().
+      //
+      void DestroyElement(Element* e);
+      void DestroyCanvas(Canvas* canvas);
+      // =======================================================================
+
+    private:
+      struct GlyphInfo
+      {
+        int X;
+        int Y;
+      };
+
+      void DrawToTexture();
+      void DrawOnScreen();
+
+      Canvas* FindCanvas(const SDL_Event& evt);
+      void ProcessCanvases(const SDL_Event& evt);
+
+      static int SDLCALL FilterEvent(void* userdata, SDL_Event* evt);
+
+      void UpdateMotionArea(const SDL_Event& evt);
+      bool IsHoverUpToDate(const SDL_Event& evt);
+      bool IsHoverUpToDate(Canvas* canvas, const SDL_Event& evt);
+      bool CalculateMotionArea(int x, int y, MotionArea& area);
+      bool AddCanvasToMotionArea(Canvas* canvas, int x, int y, MotionArea& area);
+
+      void DeleteDestroyed();
+
+      void CalculateScreenRegions();
+      void AddScreenRegion(const SDL_Rect& rect);
+
+      //
+      // True if rect is completely covered by opaque area
+      // of any canvas starting from firstOccluder in compose order.
+      //
+      bool IsOccluded(const SDL_Rect& rect, size_t firstOccluder);
+
+      //
+      // Marks area of _renderTexture (in render texture coordinates)
+      // that must be composed again from canvas layers
+      // during next Draw().
+      //
+      void AddDamage(const SDL_Rect& rect)
+      {
+        SDL_Rect r;
+
+        //
+        // Only the part that ends up on the screen matters.
+        //
+        if (!SDL_IntersectRect(&rect, &_renderDst, &r))
+        {
+          return;
+        }
+
+        AddDamagedRect(_damagedRects, r, MaxDamagedRects);
+
+        _redrawRequested = true;
+      }
+
+      void DamageAll()
+      {
+        _damagedRects.clear();
+        _damagedRects.push_back(_renderDst);
+
+        _redrawRequested = true;
+      }
+
+      const uint64_t& GetNewId()
+      {
+        _globalId++;
+        return _globalId;
+      }
+
+      //
+      // All built-in images are registered first,
+      // so they end up on the same atlas page
+      // and drawing them doesn't require texture switches.
+      //
+      void PrepareImages()
+      {
+        _textureAtlas.Init(_rendRef);
+
+        SDL_Surface* blank = LoadSurfaceFromBase64(_pixelImageBase64);
+        SDL_Surface* font  = LoadSurfaceFromBase64(_fontBase64, 255, 0, 255);
+
+        SDL_Surface* btnNormal   = LoadSurfaceFromBase64(_btnNormalBase64, 255, 0, 255);
+        SDL_Surface* btnPressed  = LoadSurfaceFromBase64(_btnPressedBase64, 255, 0, 255);
+        SDL_Surface* btnHover    = LoadSurfaceFromBase64(_btnHoverBase64, 255, 0, 255);
+        SDL_Surface* btnDisabled = LoadSurfaceFromBase64(_btnDisabledBase64, 255, 0, 255);
+
+        //
+        // Blank pixel is stored as 3x3 block and only its center is used,
+        // so that it stays the same under linear filtering.
+        //
+        SDL_Surface* blankBlock = SDL_CreateRGBSurfaceWithFormat(0,
+                                                                 3,
+                                                                 3,
+                                                                 32,
+                                                                 SDL_PIXELFORMAT_RGBA32);
+        SDL_SetSurfaceBlendMode(blank, SDL_BLENDMODE_NONE);
+
+        for (int i = 0; i < 9; i++)
+        {
+          SDL_Rect dst = { i % 3, i / 3, 1, 1 };
+          SDL_BlitSurface(blank, nullptr, blankBlock, &dst);
+        }
+
+        std::vector<std::pair<SDL_Surface*, SDL_Rect*>> images =
+        {
+          { font,        &_fontSrc        },
+          { btnNormal,   &_btnNormalSrc   },
+          { btnPressed,  &_btnPressedSrc  },
+          { btnHover,    &_btnHoverSrc    },
+          { btnDisabled, &_btnDisabledSrc },
+          { blankBlock,  &_blankImageSrc  }
+        };
+
+        //
+        // Text, buttons and blank images all draw from _atlas,
+        // so every one of these has to end up on that page.
+        //
+        for (auto& i : images)
+        {
+          ImageHandle h = _textureAtlas.Add(i.first);
+
+          if (!h.IsValid())
+          {
+            SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                         "Failed to put built-in image into texture atlas!");
+          }
+          else if (_atlas != nullptr && _atlas != h.Texture)
+          {
+            SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                         "Built-in images don't fit into single atlas page!");
+          }
+          else
+          {
+            _atlas = h.Texture;
+          }
+
+          *i.second = h.Src;
+
+          SDL_FreeSurface(i.first);
+        }
+
+        SDL_FreeSurface(blank);
+
+        _blankImageSrc = { _blankImageSrc.x + 1, _blankImageSrc.y + 1, 1, 1 };
+
+        SDL_QueryTexture(_atlas, nullptr, nullptr, &_atlasW, &_atlasH);
+      }
+
+      void CutFontGlyphs()
+      {
+        int startingChar = 32;
+
+        for (int y = 0; y < FontSheetH; y += FontH)
+        {
+          for (int x = 0; x < FontSheetW; x += FontW)
+          {
+            _fontDataByChar[startingChar] = { _fontSrc.x + x, _fontSrc.y + y };
+            startingChar++;
+          }
+        }
+
+        bool stop = false;
+      }
+
+      GlyphInfo* GetCharData(uint8_t ch)
+      {
+        GlyphInfo* res = nullptr;
+
+        if (_fontDataByChar.count(ch) == 1)
+        {
+          res = &_fontDataByChar.at(ch);
+        }
+        else
+        {
+          res = &_fontDataByChar.at('?');
+        }
+
+        return res;
+      }
+
+      SDL_Texture* CreateRenderTexture(int w, int h)
+      {
+        return SDL_CreateTexture(_rendRef,
+                                 SDL_PIXELFORMAT_RGBA32,
+                                 SDL_TEXTUREACCESS_TARGET,
+                                 w,
+                                 h);
+      }
+
+      void DestroyTexture(SDL_Texture* t)
+      {
+        _renderState.Forget(t);
+        SDL_DestroyTexture(t);
+      }
+
+      SDL_Texture* LoadImage(const std::string& fname)
+      {
+        SDL_Texture* res = nullptr;
+        SDL_Surface* s = SDL_LoadBMP(fname.data());
+        if (s == nullptr)
+        {
+          SDL_Log("%s", SDL_GetError());
+        }
+        res = SDL_CreateTextureFromSurface(_rendRef, s);
+        SDL_FreeSurface(s);
+        return res;
+      }
+
+      SDL_Texture* LoadImage(const std::string& fname,
+                             uint8_t rMask,
+                             uint8_t gMask,
+                             uint8_t bMask)
+      {
+        SDL_Texture* res = nullptr;
+        SDL_Surface* s = SDL_LoadBMP(fname.data());
+        SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGB(s->format, rMask, gMask, bMask));
+        if (s == nullptr)
+        {
+          SDL_Log("%s", SDL_GetError());
+        }
+        res = SDL_CreateTextureFromSurface(_rendRef, s);
+        SDL_FreeSurface(s);
+        return res;
+      }
+
+      SDL_Surface* LoadSurfaceFromBase64(const std::string& base64Encoded)
+      {
+        auto str = Base64_Decode(base64Encoded);
+        std::vector<unsigned char> bytes;
+        for (auto& c : str)
+        {
+            bytes.push_back(c);
+        }
+        SDL_RWops* data = SDL_RWFromMem(bytes.data(), bytes.size());
+        SDL_Surface* s = SDL_LoadBMP_RW(data, 1);
+        if (s == nullptr)
+        {
+          SDL_Log("%s", SDL_GetError());
+        }
+        return s;
+      }
+
+      SDL_Surface* LoadSurfaceFromBase64(const std::string& base64Encoded,
+                                         uint8_t rMask,
+                                         uint8_t gMask,
+                                         uint8_t bMask)
+      {
+        SDL_Surface* s = LoadSurfaceFromBase64(base64Encoded);
+        if (s != nullptr)
+        {
+          SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGB(s->format, rMask, gMask, bMask));
+        }
+        return s;
+      }
+
+      //
+      // Clip rects are kept on CPU side and every pushed rect
+      // is intersected with the one on top of the stack,
+      // so renderer is never asked about its clip rect.
+      // Empty stack means clipping is disabled.
+      //
+      void PushClipRect(const SDL_Rect& rect)
+      {
+        SDL_Rect r = rect;
+
+        if (!_renderClipRects.empty()
+         && !SDL_IntersectRect(&_renderClipRects.top(), &rect, &r))
+        {
+          r = { rect.x, rect.y, 0, 0 };
+        }
+
+        _renderClipRects.push(r);
+
+        ApplyClipRect();
+      }
+
+      void PopClipRect()
+      {
+        if (!_renderClipRects.empty())
+        {
+          _renderClipRects.pop();
+        }
+
+        ApplyClipRect();
+      }
+
+      //
+      // Sets top of the stack as renderer's clip rect,
+      // e.g. after render target has been switched back.
+      //
+      void ApplyClipRect()
+      {
+        if (_renderClipRects.empty())
+        {
+          _renderState.SetClipRect(nullptr);
+        }
+        else
+        {
+          _renderState.SetClipRect(&_renderClipRects.top());
+        }
+      }
+
+      //
+      // True if nothing from rect will make it through current clip,
+      // so there's no point in drawing it.
+      //
+      bool IsFullyClipped(const SDL_Rect& rect)
+      {
+        return (!_renderClipRects.empty()
+             && !SDL_HasIntersection(&_renderClipRects.top(), &rect));
+      }
+
+      std::string Base64_Decode(const std::string& encoded_string)
+      {
+        int in_len = encoded_string.size();
+        int i = 0;
+        int j = 0;
+        int in_ = 0;
+        unsigned char char_array_4[4], char_array_3[3];
+        std::string ret;
+
+        while (in_len-- && ( encoded_string[in_] != '=') && IsBase64(encoded_string[in_]))
+        {
+          char_array_4[i++] = encoded_string[in_]; in_++;
+          if (i ==4)
+          {
+            for (i = 0; i <4; i++)
+            {
+              char_array_4[i] = _base64Chars.find(char_array_4[i]);
+            }
+
+            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+            for (i = 0; (i < 3); i++)
+            {
+              ret += char_array_3[i];
+            }
+
+            i = 0;
+          }
+        }
+
+        if (i)
+        {
+          for (j = i; j <4; j++)
+          {
+            char_array_4[j] = 0;
+          }
+
+          for (j = 0; j <4; j++)
+          {
+            char_array_4[j] = _base64Chars.find(char_array_4[j]);
+          }
+
+          char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+          char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+          char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+          for (j = 0; (j < i - 1); j++)
+          {
+            ret += char_array_3[j];
+          }
+        }
+
+        return ret;
+      }
+
+      bool IsBase64(unsigned char c)
+      {
+        auto res = std::find(_base64Chars.begin(),
+                             _base64Chars.end(),
+                             c);
+
+        return (res != _base64Chars.end());
+      }
+
+      void CreateScreenCanvas();
+
+      void* AllocateElement(size_t size)
+      {
+        auto it = _elementPools.find(size);
+
+        if (it == _elementPools.end())
+        {
+          it = _elementPools.emplace(size, ObjectPool(size)).first;
+        }
+
+        return it->second.Allocate();
+      }
+
+      void FreeElement(void* p, size_t size)
+      {
+        _elementPools.at(size).Free(p);
+      }
+
+      SDL_Renderer* _rendRef = nullptr;
+      SDL_Window* _windowRef = nullptr;
+
+      TextureAtlas _textureAtlas;
+
+      //
+      // Atlas page with built-in images.
+      //
+      SDL_Texture* _atlas = nullptr;
+
+      SDL_Rect _fontSrc;
+      SDL_Rect _blankImageSrc;
+
+      SDL_Rect _btnNormalSrc;
+      SDL_Rect _btnPressedSrc;
+      SDL_Rect _btnHoverSrc;
+      SDL_Rect _btnDisabledSrc;
+
+      int _atlasW = 0;
+      int _atlasH = 0;
+
+      SDL_Texture* _renderTexture = nullptr;
+
+      RenderState _renderState;
+
+      SDL_Color _oldRenderColor;
+
+      SDL_BlendMode _oldRenderBlendMode = SDL_BLENDMODE_NONE;
+      SDL_BlendMode _layerBlendMode     = SDL_BLENDMODE_BLEND;
+
+      SDL_Rect _renderDst;
+
+      bool _initialized     = false;
+      bool _redrawRequested = false;
+      bool _coalesceMotion  = false;
+      bool _motionFilter    = false;
+
+      Uint32 _windowId = 0;
+
+      SDL_EventFilter _prevFilter = nullptr;
+      void* _prevFilterData       = nullptr;
+
+      //
+      // Read by event filter, which may be called from any thread.
+      // Empty if nothing can be dropped.
+      //
+      MotionArea _motionArea;
+      SDL_SpinLock _motionLock = 0;
+
+      //
+      // Incremented every time contents of render targets are lost,
+      // so that cached textures know they must be redrawn.
+      //
+      uint64_t _targetsGeneration = 0;
+
+      int _windowWidth  = 0;
+      int _windowHeight = 0;
+
+      const uint8_t FontW = 8;
+      const uint8_t FontH = 16;
+      const uint8_t FontSheetW = 128;
+      const uint8_t FontSheetH = 96;
+
+      uint64_t _globalId = 0;
+
+      //
+      // Storage for elements, one pool per object size.
+      // Must outlive everything that owns elements,
+      // so it's declared before any of those.
+      //
+      std::map<size_t, ObjectPool> _elementPools;
+
+      SlotMap<Canvas> _canvases;
+      std::map<uint8_t, GlyphInfo> _fontDataByChar;
+
+      std::unique_ptr<Canvas> _screenCanvas;
+
+      //
+      // Canvases in window coordinates, for hit testing.
+      //
+      SpatialGrid _canvasesGrid;
+
+      Canvas* _topCanvas = nullptr;
+
+      std::vector<std::unique_ptr<Element>> _destroyed;
+
+      std::stack<SDL_Rect> _renderClipRects;
+
+      std::vector<SDL_Rect> _damagedRects;
+
+      //
+      // Non-overlapping parts of the screen
+      // that actually have something drawn on them.
+      //
+      std::vector<SDL_Rect> _screenRegions;
+      std::vector<SDL_Rect> _regionPieces;
+      std::vector<SDL_Rect> _regionPiecesLeft;
+
+      std::vector<Canvas*> _composeOrder;
+      std::vector<SDL_Rect> _opaqueRects;
+
+      const size_t MaxDamagedRects = 8;
+
+      const static std::string _base64Chars;
+      const static std::string _fontBase64;
+      const static std::string _pixelImageBase64;
+
+      const static std::string _btnNormalBase64;
+      const static std::string _btnPressedBase64;
+      const static std::string _btnHoverBase64;
+      const static std::string _btnDisabledBase64;
+
+      friend class Element;
+      friend class Canvas;
+      friend class Image;
+      friend class Text;
+      friend class Button;
+  };
+
+// =============================================================================
+//                              BASE WIDGET CLASS
+// =============================================================================
+  class Element
+  {
+    public:
+      Element(Canvas* parent,
+              const SDL_Rect& transform);
+
+      virtual ~Element() = default;
+
+      //
+      // Elements are allocated from Manager's pools.
+      //
+      static void* operator new(size_t size);
+      static void operator delete(void* p, size_t size);
+
+      void SetEnabled(bool enabled)
+      {
+        if (_enabled != enabled)
+        {
+          Invalidate();
+        }
+
+        _enabled = enabled;
+
+        if (!_enabled)
+        {
+          _mouseEnter = false;
+        }
+
+        UpdateHotData();
+      }
+
+      bool IsEnabled()
+      {
+        return _enabled;
+      }
+
+      void SetVisible(bool visible)
+      {
+        if (_visible != visible)
+        {
+          Invalidate();
+        }
+
+        _visible = visible;
+
+        if (!_visible)
+        {
+          _mouseEnter = false;
+        }
+
+        UpdateHotData();
+      }
+
+      bool IsVisible()
+      {
+        return _visible;
+      }
+
+      bool IsEnabledAndVisible()
+      {
+        return (_enabled && _visible);
+      }
+
+      void ShowOutline(bool value)
+      {
+        if (_showOutline != value)
+        {
+          Invalidate();
+        }
+
+        _showOutline = value;
+      }
+
+      const uint64_t& Id()
+      {
+        return _id;
+      }
+
+      //
+      // Resolved by owner canvas (by Manager for canvases),
+      // so it outlives the element safely.
+      //
+      const ElementHandle& Handle()
+      {
+        return _handle;
+      }
+
+      const SDL_Rect& Transform()
+      {
+        return (_owner == nullptr) ? _transform : _localTransform;
+      }
+
+      const SDL_Rect& GetCornersCoordsAbsolute()
+      {
+        _corners.x = _renderTransform.x;
+        _corners.y = _renderTransform.y;
+        _corners.w = _renderTransform.x + _renderTransform.w;
+        _corners.h = _renderTransform.y + _renderTransform.h;
+
+        return _corners;
+      }
+
+      virtual void SetTransform(const SDL_Rect& transform);
+
+      void HandleEvents(const SDL_Event& evt)
+      {
+        if (!_enabled || !_visible)
+        {
+          return;
+        }
+
+        switch (evt.type)
+        {
+          case SDL_MOUSEMOTION:
+          {
+            if (IsMouseInside(evt))
+            {
+              if (!_mouseEnter)
+              {
                 _mouseEnter = true;
                 RaiseEvent(EventType::MOUSE_OVER);
               }
 
-              RaiseEvent(EventType::MOUSE_MOVE);
+              RaiseEvent(EventType::MOUSE_MOVE);
+            }
+            else
+            {
+              if (_mouseEnter)
+              {
+                _mouseEnter = false;
+                RaiseEvent(EventType::MOUSE_OUT);
+              }
+            }
+          }
+          break;
+
+          case SDL_MOUSEBUTTONDOWN:
+          {
+            if (IsMouseInside(evt))
+            {
+              RaiseEvent(EventType::MOUSE_DOWN);
+            }
+          }
+          break;
+
+          case SDL_MOUSEBUTTONUP:
+          {
+            if (IsMouseInside(evt))
+            {
+              RaiseEvent(EventType::MOUSE_UP);
+            }
+          }
+          break;
+        }
+      }
+
+      void ResetHandlers()
+      {
+        if (_handlers == nullptr)
+        {
+          return;
+        }
+
+        for (size_t i = 0; i < EventTypesCount; i++)
+        {
+          _handlers->User[i].DisconnectAll();
+          UpdateListeners(i);
+        }
+      }
+
+      void Draw()
+      {
+        if (_visible && !Manager::Get().IsFullyClipped(DrawBounds()))
+        {
+          DrawImpl();
+
+          if (_showOutline)
+          {
+            DrawOutline();
+          }
+        }
+      }
+
+      using Handler = Signal<Element*>;
+
+      //
+      // Handlers live in a separate table which is allocated
+      // the first time any of them is accessed,
+      // since most elements never get one.
+      //
+      Handler& OnMouseDown()
+      {
+        return HandlerUser(EventType::MOUSE_DOWN);
+      }
+
+      Handler& OnMouseUp()
+      {
+        return HandlerUser(EventType::MOUSE_UP);
+      }
+
+      Handler& OnMouseOver()
+      {
+        return HandlerUser(EventType::MOUSE_OVER);
+      }
+
+      Handler& OnMouseOut()
+      {
+        return HandlerUser(EventType::MOUSE_OUT);
+      }
+
+      Handler& OnMouseMove()
+      {
+        return HandlerUser(EventType::MOUSE_MOVE);
+      }
+
+    protected:
+      bool IsMouseInside(const SDL_Event& evt);
+
+      void UpdateTransform();
+      void UpdateHotData();
+
+      //
+      // Marks area occupied by this element as the one
+      // that needs to be redrawn.
+      //
+      void Invalidate()
+      {
+        Damage(DrawBounds());
+        UpdateHotData();
+      }
+
+      void Damage(const SDL_Rect& rect);
+
+      //
+      // Makes element a part of this one,
+      // so they're destroyed together.
+      //
+      void AddPart(Element* e)
+      {
+        e->_composite = this;
+        _parts.push_back(e);
+      }
+
+      //
+      // Called right before element is deleted.
+      //
+      virtual void ReleaseTextures() {}
+
+      //
+      // Area in render target coordinates
+      // that is touched by this element when drawn
+      // (owner's layer for elements, _renderTexture for canvases).
+      //
+      virtual SDL_Rect DrawBounds()
+      {
+        return _renderTransform;
+      }
+
+      virtual void DrawImpl() = 0;
+
+      //
+      // True if element overwrites every pixel of its draw bounds,
+      // so whatever was drawn there before it can be skipped.
+      //
+      virtual bool IsOccluder()
+      {
+        return false;
+      }
+
+      //
+      // True if every pixel of element's draw bounds
+      // ends up fully opaque in the layer.
+      //
+      virtual bool IsOpaque()
+      {
+        return false;
+      }
+
+      //
+      // True if element can make already opaque pixels
+      // of the layer transparent again.
+      //
+      virtual bool CanLowerAlpha()
+      {
+        return false;
+      }
+
+      //
+      // Draw color is restored by Manager at the end of the frame,
+      // so there's no need to save it here.
+      //
+      void DrawOutline()
+      {
+        auto& rs = Manager::Get()._renderState;
+
+        if (_enabled)
+        {
+          rs.SetDrawColor(255, 255, 255, 255);
+        }
+        else
+        {
+          rs.SetDrawColor(255, 0, 0, 255);
+        }
+
+        auto& r = _renderTransform;
+
+        SDL_RenderDrawRect(_rendRef, &r);
+
+        SDL_RenderDrawLine(_rendRef,
+                           r.x,
+                           r.y,
+                           r.x + r.w - 1,
+                           r.y + r.h - 1);
+
+        SDL_RenderDrawLine(_rendRef,
+                           r.x,
+                           r.y + r.h - 1,
+                           r.x + r.w - 1,
+                           r.y);
+      }
+
+      void ResetHandlersIntl()
+      {
+        if (_handlers == nullptr)
+        {
+          return;
+        }
+
+        for (size_t i = 0; i < EventTypesCount; i++)
+        {
+          _handlers->Intl[i].DisconnectAll();
+          UpdateListeners(i);
+        }
+      }
+
+      //
+      // Handlers used by the library itself,
+      // called before the user ones.
+      //
+      Handler& HandlerIntl(EventType eventType)
+      {
+        size_t index = (size_t)eventType;
+
+        _listeners |= (uint16_t)(1 << index);
+
+        return Handlers().Intl[index];
+      }
+
+      Handler& HandlerUser(EventType eventType)
+      {
+        size_t index = (size_t)eventType;
+
+        _listeners |= (uint16_t)(1 << (index + EventTypesCount));
+
+        return Handlers().User[index];
+      }
+
+      void RaiseEvent(EventType eventType)
+      {
+        //
+        // Hovering and pressing usually changes
+        // how things look like.
+        //
+        if (eventType != EventType::MOUSE_MOVE)
+        {
+          Manager::Get().RequestRedraw();
+        }
+
+        size_t index = (size_t)eventType;
+
+        if (index >= EventTypesCount)
+        {
+          SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                      "Unknown event type: %i",
+                      (int)eventType);
+          return;
+        }
+
+        //
+        // Most elements have no handlers at all.
+        //
+        if ((_listeners & ListenersOf(index)) == 0)
+        {
+          return;
+        }
+
+        _handlers->Intl[index].Emit(this);
+        _handlers->User[index].Emit(this);
+
+        UpdateListeners(index);
+      }
+
+      SDL_Rect _transform;
+      SDL_Rect _localTransform;
+      SDL_Rect _renderTransform = { 0, 0, 0, 0 };
+      SDL_Rect _corners;
+
+      SDL_Renderer* _rendRef = nullptr;
+
+
+      uint64_t _id = 0;
+
+      ElementHandle _handle;
+
+      bool _mouseEnter = false;
+
+      bool _enabled     = true;
+      bool _visible     = true;
+      bool _showOutline = false;
+
+      static const size_t EventTypesCount = (size_t)EventType::MOUSE_UP + 1;
+
+      struct EventHandlers
+      {
+        Handler Intl[EventTypesCount];
+        Handler User[EventTypesCount];
+      };
+
+      //
+      // Library handlers of event type use lower bits,
+      // user handlers use the ones above them.
+      //
+      static uint16_t ListenersOf(size_t index)
+      {
+        return (uint16_t)((1 << index) | (1 << (index + EventTypesCount)));
+      }
+
+      EventHandlers& Handlers()
+      {
+        //
+        // Caller may be about to add a listener.
+        //
+        Manager::Get().InvalidateMotionArea();
+
+        if (_handlers == nullptr)
+        {
+          _handlers = std::make_unique<EventHandlers>();
+        }
+
+        return *_handlers;
+      }
+
+      //
+      // Clears bits of signals that turned out to be empty.
+      //
+      void UpdateListeners(size_t index)
+      {
+        if (_handlers->Intl[index].IsEmpty())
+        {
+          _listeners &= (uint16_t)~(1 << index);
+        }
+
+        if (_handlers->User[index].IsEmpty())
+        {
+          _listeners &= (uint16_t)~(1 << (index + EventTypesCount));
+        }
+      }
+
+      std::unique_ptr<EventHandlers> _handlers;
+
+      //
+      // Bit is set for every signal in _handlers that may have subscribers:
+      // as soon as signal is handed out, since caller is about
+      // to connect to it, and until it's found empty on emit.
+      //
+      uint16_t _listeners = 0;
+
+      Canvas* _owner = nullptr;
+
+      //
+      // Grid this element is hit tested through, if any.
+      //
+      SpatialGrid* _hitGrid = nullptr;
+      SpatialGrid::CellRange _hitCells;
+
+      //
+      // Position in owner's element table, -1 if not there yet.
+      //
+      int _tableIndex = -1;
+
+      //
+      // Element this one is a part of (e.g. button's image),
+      // and parts of this one.
+      //
+      Element* _composite = nullptr;
+      std::vector<Element*> _parts;
+
+      //
+      // Destroyed elements are unlinked from everything at once,
+      // but deleted only later, since they may be destroyed
+      // from their own event handlers.
+      //
+      bool _destroyed = false;
+
+      friend class Canvas;
+      friend class Manager;
+      friend class Button;
+      friend class SpatialGrid;
+      friend class ElementTable;
+  };
+
+// =============================================================================
+//                              CANVAS
+// =============================================================================
+  class Canvas : public Element
+  {
+    public:
+      Canvas(const SDL_Rect& transform,
+             SDL_Renderer* rendRef)
+        : Element(nullptr, transform)
+      {
+        _rendRef = rendRef;
+
+        _elementsGrid.Reset(transform.w, transform.h);
+      }
+
+      void HandleEvents(const SDL_Event& evt)
+      {
+        //
+        // Disabled canvas should not handle events at all.
+        //
+        if (!_enabled || !_visible)
+        {
+          return;
+        }
+
+        Element::HandleEvents(evt);
+
+        switch (evt.type)
+        {
+          case SDL_MOUSEMOTION:
+          case SDL_MOUSEBUTTONUP:
+          case SDL_MOUSEBUTTONDOWN:
+          {
+            Element* newElement = FindElement(evt);
+
+            if (_topElement != newElement)
+            {
+              //
+              // Handler may destroy either element,
+              // which is still in memory until next HandleEvents(),
+              // but must not be kept as the top one.
+              //
+              Element* oldElement = _topElement;
+
+              if (oldElement != nullptr)
+              {
+                oldElement->RaiseEvent(EventType::MOUSE_OUT);
+                oldElement->_mouseEnter = false;
+              }
+
+              if (newElement != nullptr && newElement->_destroyed)
+              {
+                newElement = nullptr;
+              }
+
+              _topElement = newElement;
+            }
+          }
+          break;
+        }
+
+        if (_topElement != nullptr && !_topElement->_destroyed)
+        {
+          _topElement->HandleEvents(evt);
+        }
+      }
+
+      void SetTransform(const SDL_Rect& transform) override
+      {
+        bool resized = (transform.w != _transform.w
+                     || transform.h != _transform.h);
+
+        Element::SetTransform(transform);
+        Element::UpdateTransform();
+
+        //
+        // Elements are put back into resized grid
+        // when their transforms are updated below.
+        //
+        if (resized)
+        {
+          _elementsGrid.Reset(_transform.w, _transform.h);
+
+          for (auto& e : _elements)
+          {
+            e->_hitCells = SpatialGrid::CellRange();
+          }
+        }
+
+        for (auto& e : _elements)
+        {
+          e->UpdateTransform();
+        }
+      }
+
+      //
+      // Null if handle is invalid or refers to element
+      // that doesn't exist anymore.
+      //
+      Element* GetElement(const ElementHandle& handle)
+      {
+        return _elements.Get(handle);
+      }
+
+    protected:
+      void DrawImpl() override {}
+
+      void ReleaseTextures() override
+      {
+        for (auto& e : _elements)
+        {
+          e->ReleaseTextures();
+        }
+
+        if (_layer != nullptr)
+        {
+          Manager::Get().DestroyTexture(_layer);
+          _layer = nullptr;
+        }
+      }
+
+    private:
+      //
+      // Elements are collected topmost first, so the ones
+      // completely hidden behind occluders above them are skipped.
+      //
+      void Draw(const SDL_Rect& clip)
+      {
+        _drawList.clear();
+        _occluders.clear();
+
+        _table.Cull(clip, _drawCandidates);
+
+        SDL_Rect b;
+
+        for (int index : _drawCandidates)
+        {
+          Element* e = _table.At(index);
+
+          SDL_Rect bounds = _table.DrawBounds(index);
+          SDL_IntersectRect(&bounds, &clip, &b);
+
+          bool hidden = false;
+
+          for (auto& o : _occluders)
+          {
+            if (Contains(o, b))
+            {
+              hidden = true;
+              break;
+            }
+          }
+
+          if (hidden)
+          {
+            continue;
+          }
+
+          _drawList.push_back(e);
+
+          if (e->IsOccluder())
+          {
+            //
+            // Nothing below is visible anymore.
+            //
+            if (Contains(b, clip))
+            {
+              break;
+            }
+
+            if (_occluders.size() < MaxOccluders)
+            {
+              _occluders.push_back(b);
+            }
+          }
+        }
+
+        for (auto it = _drawList.rbegin(); it != _drawList.rend(); it++)
+        {
+          (*it)->Draw();
+        }
+      }
+
+      //
+      // Biggest area of the layer (in render texture coordinates)
+      // that is known to be fully opaque.
+      //
+      SDL_Rect OpaqueBounds()
+      {
+        SDL_Rect layerRect = { 0, 0, _transform.w, _transform.h };
+        SDL_Rect res = { 0, 0, 0, 0 };
+        SDL_Rect b;
+
+        for (auto& e : _elements)
+        {
+          SDL_Rect bounds = e->DrawBounds();
+
+          if (!e->_visible || !SDL_IntersectRect(&bounds, &layerRect, &b))
+          {
+            continue;
+          }
+
+          if (e->IsOpaque())
+          {
+            if (b.w * b.h > res.w * res.h)
+            {
+              res = b;
+            }
+          }
+          else if (e->CanLowerAlpha() && SDL_HasIntersection(&b, &res))
+          {
+            res = { 0, 0, 0, 0 };
+          }
+        }
+
+        if (SDL_RectEmpty(&res))
+        {
+          return { 0, 0, 0, 0 };
+        }
+
+        res.x += _renderTransform.x;
+        res.y += _renderTransform.y;
+
+        return res;
+      }
+
+      //
+      // Marks area of the layer (in layer coordinates)
+      // that needs to be redrawn.
+      //
+      void AddDamage(const SDL_Rect& rect)
+      {
+        SDL_Rect layerRect = { 0, 0, _transform.w, _transform.h };
+        SDL_Rect r;
+
+        if (!SDL_IntersectRect(&rect, &layerRect, &r))
+        {
+          return;
+        }
+
+        AddDamagedRect(_damagedRects, r, Manager::Get().MaxDamagedRects);
+
+        r.x += _renderTransform.x;
+        r.y += _renderTransform.y;
+
+        Manager::Get().AddDamage(r);
+      }
+
+      //
+      // Area of render texture that has anything drawn on it
+      // by this canvas.
+      //
+      SDL_Rect ContentBounds()
+      {
+        if (_showOutline)
+        {
+          return _renderTransform;
+        }
+
+        SDL_Rect res = { 0, 0, 0, 0 };
+
+        for (auto& e : _elements)
+        {
+          if (e->_visible)
+          {
+            SDL_Rect b = e->DrawBounds();
+            SDL_UnionRect(&res, &b, &res);
+          }
+        }
+
+        res.x += _renderTransform.x;
+        res.y += _renderTransform.y;
+
+        SDL_Rect clipped;
+
+        if (!SDL_IntersectRect(&res, &_renderTransform, &clipped))
+        {
+          return { 0, 0, 0, 0 };
+        }
+
+        return clipped;
+      }
+
+      void DamageLayer()
+      {
+        _damagedRects.clear();
+        _damagedRects.push_back({ 0, 0, _transform.w, _transform.h });
+      }
+
+      //
+      // Redraws damaged areas of the layer,
+      // recreating it first if canvas has been resized.
+      //
+      void UpdateLayer(const SDL_Rect* occluders, size_t occludersCount)
+      {
+        if (_transform.w <= 0 || _transform.h <= 0)
+        {
+          return;
+        }
+
+        //
+        // Parts of the layer that are off the window
+        // or behind opaque canvases above can't be seen,
+        // so they stay damaged until they're uncovered.
+        //
+        if (!CalculateVisibleRects(occluders, occludersCount))
+        {
+          return;
+        }
+
+        if (_layer == nullptr
+         || _layerW != _transform.w
+         || _layerH != _transform.h)
+        {
+          if (_layer != nullptr)
+          {
+            Manager::Get().DestroyTexture(_layer);
+          }
+
+          _layerW = _transform.w;
+          _layerH = _transform.h;
+
+          _layer = Manager::Get().CreateRenderTexture(_layerW, _layerH);
+
+          Manager::Get()._renderState.SetTextureBlendMode(_layer,
+                                                          Manager::Get()._layerBlendMode);
+
+          DamageLayer();
+        }
+
+        if (_damagedRects.empty())
+        {
+          return;
+        }
+
+        auto& rs = Manager::Get()._renderState;
+
+        _hiddenRects.clear();
+
+        SDL_Rect r;
+
+        for (auto& dr : _damagedRects)
+        {
+          _rectPieces.clear();
+          _rectPieces.push_back(dr);
+
+          for (auto& v : _visibleRects)
+          {
+            if (SDL_IntersectRect(&dr, &v, &r))
+            {
+              rs.SetRenderTarget(_layer);
+
+              //
+              // SDL_RenderClear() ignores clip rect,
+              // so damaged area is cleared by filling it instead.
+              //
+              Manager::Get().PushClipRect(r);
+
+              rs.SetDrawBlendMode(SDL_BLENDMODE_NONE);
+              rs.SetDrawColor(0, 0, 0, 0);
+              SDL_RenderFillRect(_rendRef, &r);
+
+              Draw(r);
+
+              Manager::Get().PopClipRect();
             }
-            else
+
+            _rectPiecesLeft.clear();
+
+            for (auto& p : _rectPieces)
             {
-              if (_mouseEnter)
-              {
-                _mouseEnter = false;
-                RaiseEvent(EventType::MOUSE_OUT);
-              }
+              SubtractRect(p, v, _rectPiecesLeft);
             }
+
+            std::swap(_rectPieces, _rectPiecesLeft);
           }
-          break;
 
-          case SDL_MOUSEBUTTONDOWN:
-          {
-            if (IsMouseInside(evt))
-            {
-              RaiseEvent(EventType::MOUSE_DOWN);
-            }
-          }
-          break;
+          _hiddenRects.insert(_hiddenRects.end(),
+                              _rectPieces.begin(),
+                              _rectPieces.end());
+        }
+
+        _damagedRects.clear();
+
+        for (auto& h : _hiddenRects)
+        {
+          AddDamagedRect(_damagedRects, h, Manager::Get().MaxDamagedRects);
+        }
+      }
+
+      //
+      // Parts of the layer (in layer coordinates) that are on the window
+      // and not covered by any of the occluders (in render texture coordinates).
+      // Returns false if there are none.
+      //
+      bool CalculateVisibleRects(const SDL_Rect* occluders,
+                                 size_t occludersCount)
+      {
+        SDL_Rect onWindow;
+
+        _visibleRects.clear();
+
+        if (!SDL_IntersectRect(&_renderTransform,
+                               &Manager::Get()._renderDst,
+                               &onWindow))
+        {
+          return false;
+        }
+
+        _visibleRects.push_back(onWindow);
+
+        for (size_t i = 0; i < occludersCount; i++)
+        {
+          //
+          // Keeping whatever is left as visible is always correct,
+          // it just means more drawing.
+          //
+          if (_visibleRects.empty() || _visibleRects.size() > MaxVisibleRects)
+          {
+            break;
+          }
+
+          _rectPiecesLeft.clear();
+
+          for (auto& v : _visibleRects)
+          {
+            SubtractRect(v, occluders[i], _rectPiecesLeft);
+          }
+
+          std::swap(_visibleRects, _rectPiecesLeft);
+        }
+
+        for (auto& v : _visibleRects)
+        {
+          v.x -= _renderTransform.x;
+          v.y -= _renderTransform.y;
+        }
+
+        return !_visibleRects.empty();
+      }
+
+      //
+      // Copies part of the layer that falls into clip
+      // (in render texture coordinates) onto current target.
+      //
+      void Compose(const SDL_Rect& clip)
+      {
+        if (_layer == nullptr)
+        {
+          return;
+        }
+
+        SDL_Rect src =
+        {
+          clip.x - _renderTransform.x,
+          clip.y - _renderTransform.y,
+          clip.w,
+          clip.h
+        };
+
+        Manager::Get().PushClipRect(clip);
+
+        SDL_RenderCopy(_rendRef, _layer, &src, &clip);
+
+        if (_showOutline)
+        {
+          DrawOutline();
+        }
+
+        Manager::Get().PopClipRect();
+      }
+
+      Element* Add(Element* e)
+      {
+        if (e == nullptr)
+        {
+          SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                       "Trying to add null to canvas!");
+          return nullptr;
+        }
+
+        e->_handle = _elements.Insert(e);
+
+        return e;
+      }
+
+      Element* FindElement(const SDL_Event& evt)
+      {
+        Element* res = nullptr;
+
+        int x = evt.motion.x - _transform.x;
+        int y = evt.motion.y - _transform.y;
+
+        if (_elementsGrid.Contains(x, y))
+        {
+          res = _elementsGrid.Find(x, y, evt);
+        }
+        else
+        {
+          //
+          // Check against canvas' rect is the same for all elements,
+          // so it's enough to do it for the topmost one.
+          //
+          res = _table.Find(x, y);
+
+          if (res != nullptr && !res->IsMouseInside(evt))
+          {
+            res = nullptr;
+          }
+        }
+
+        return res;
+      }
+
+      //
+      // Element is unlinked from everything right away
+      // and handed to Manager, which deletes it later.
+      //
+      void Remove(Element* e)
+      {
+        for (auto& p : e->_parts)
+        {
+          Remove(p);
+        }
+
+        e->Invalidate();
+        e->_destroyed = true;
+
+        if (_topElement == e)
+        {
+          _topElement = nullptr;
+        }
+
+        _elementsGrid.Remove(e);
+        _table.Remove(e);
+
+        Manager::Get().InvalidateMotionArea();
+
+        Manager::Get()._destroyed.push_back(_elements.Remove(e->_handle));
+      }
+
+      SlotMap<Element> _elements;
+      std::vector<SDL_Rect> _damagedRects;
+      std::vector<SDL_Rect> _visibleRects;
+      std::vector<SDL_Rect> _hiddenRects;
+      std::vector<SDL_Rect> _rectPieces;
+      std::vector<SDL_Rect> _rectPiecesLeft;
+
+      std::vector<int>      _drawCandidates;
+      std::vector<Element*> _drawList;
+      std::vector<SDL_Rect> _occluders;
+
+      SpatialGrid  _elementsGrid;
+      ElementTable _table;
+
+      const size_t MaxOccluders    = 8;
+      const size_t MaxVisibleRects = 16;
+
+      Element* _topElement = nullptr;
+
+      SDL_Texture* _layer = nullptr;
+
+      int _layerW = 0;
+      int _layerH = 0;
+
+      friend class Element;
+      friend class Manager;
+  };
+
+// =============================================================================
+//                             DEFINITIONS
+// =============================================================================
+  Element::Element(Canvas* parent,
+                   const SDL_Rect& transform)
+  {
+    _owner   = parent;
+    _rendRef = Manager::Get()._rendRef;
+
+    _id = Manager::Get().GetNewId();
+
+    if (_owner != nullptr)
+    {
+      _hitGrid = &_owner->_elementsGrid;
+    }
+
+    SetTransform(transform);
+    UpdateTransform();
+  }
+
+  void* Element::operator new(size_t size)
+  {
+    return Manager::Get().AllocateElement(size);
+  }
+
+  void Element::operator delete(void* p, size_t size)
+  {
+    Manager::Get().FreeElement(p, size);
+  }
+
+  void Element::SetTransform(const SDL_Rect& transform)
+  {
+    _localTransform = transform;
+    UpdateTransform();
+  }
+
+  void Element::UpdateTransform()
+  {
+    SDL_Rect oldBounds = DrawBounds();
+
+    if (_owner == nullptr)
+    {
+      _transform = _localTransform;
+    }
+    else
+    {
+      auto& pt = _owner->Transform();
+
+      _transform.x = _localTransform.x + pt.x;
+      _transform.y = _localTransform.y + pt.y;
+      _transform.w = _localTransform.w;
+      _transform.h = _localTransform.h;
+    }
+
+    //
+    // Canvases are composed onto _renderTexture,
+    // while elements are drawn into their canvas' layer,
+    // so they're positioned relative to it.
+    //
+    if (_owner == nullptr)
+    {
+      _renderTransform = Manager::Get()._renderDst;
+
+      _renderTransform.x += _transform.x;
+      _renderTransform.y += _transform.y;
+    }
+    else
+    {
+      _renderTransform.x = _localTransform.x;
+      _renderTransform.y = _localTransform.y;
+    }
+
+    _renderTransform.w = _transform.w;
+    _renderTransform.h = _transform.h;
+
+    //
+    // Old area must be cleared as well.
+    //
+    SDL_Rect newBounds = DrawBounds();
+
+    if (!SDL_RectEquals(&oldBounds, &newBounds))
+    {
+      Damage(oldBounds);
+      Damage(newBounds);
+    }
+
+    UpdateHotData();
+  }
+
+  //
+  // Elements are kept in grid in owner's coordinates,
+  // so moving canvas doesn't affect its grid.
+  //
+  void Element::UpdateHotData()
+  {
+    if (_destroyed)
+    {
+      return;
+    }
+
+    Manager::Get().InvalidateMotionArea();
+
+    if (_hitGrid != nullptr)
+    {
+      _hitGrid->Update(this, _localTransform, _visible);
+    }
+
+    if (_owner != nullptr)
+    {
+      _owner->_table.Update(this);
+    }
+  }
 
-          case SDL_MOUSEBUTTONUP:
-          {
-            if (IsMouseInside(evt))
-            {
-              RaiseEvent(EventType::MOUSE_UP);
-            }
-          }
-          break;
-        }
-      }
+  void SpatialGrid::Update(Element* e, const SDL_Rect& rect, bool present)
+  {
+    CellRange cr = present ? CellsOf(rect) : CellRange();
 
-      void ResetHandlers()
+    if (cr == e->_hitCells)
+    {
+      return;
+    }
+
+    Remove(e);
+
+    e->_hitCells = cr;
+
+    auto byId = [](Element* a, Element* b)
+    {
+      return (a->Id() < b->Id());
+    };
+
+    for (int y = cr.Y0; y <= cr.Y1; y++)
+    {
+      for (int x = cr.X0; x <= cr.X1; x++)
       {
-        OnMouseDown = std::function<void(Element*)>();
-        OnMouseUp   = std::function<void(Element*)>();
-        OnMouseOver = std::function<void(Element*)>();
-        OnMouseOut  = std::function<void(Element*)>();
-        OnMouseMove = std::function<void(Element*)>();
+        auto& cell = Cell(x, y);
+        cell.insert(std::lower_bound(cell.begin(), cell.end(), e, byId), e);
       }
+    }
+  }
 
-      void Draw()
-      {
-        if (_visible)
-        {
-          DrawImpl();
+  void SpatialGrid::Remove(Element* e)
+  {
+    auto& cr = e->_hitCells;
 
-          if (_showOutline)
-          {
-            DrawOutline();
-          }
-        }
+    for (int y = cr.Y0; y <= cr.Y1; y++)
+    {
+      for (int x = cr.X0; x <= cr.X1; x++)
+      {
+        auto& cell = Cell(x, y);
+        cell.erase(std::remove(cell.begin(), cell.end(), e), cell.end());
       }
+    }
 
-      std::function<void(Element*)> OnMouseDown;
-      std::function<void(Element*)> OnMouseUp;
-      std::function<void(Element*)> OnMouseOver;
-      std::function<void(Element*)> OnMouseOut;
-      std::function<void(Element*)> OnMouseMove;
+    cr = CellRange();
+  }
 
-    protected:
-      bool IsMouseInside(const SDL_Event& evt);
+  Element* SpatialGrid::Find(int x, int y, const SDL_Event& evt)
+  {
+    auto& cell = Cell(x / CellSize, y / CellSize);
 
-      template <typename F>
-      bool CanBeCalled(const F& fn)
+    for (auto it = cell.rbegin(); it != cell.rend(); it++)
+    {
+      if ((*it)->IsEnabledAndVisible()
+       && (*it)->IsMouseInside(evt))
       {
-        return (fn.target_type() != typeid(void));
+        return *it;
       }
+    }
 
-      template <typename CallbackIntl, typename Callback>
-      void CallHandlers(const CallbackIntl& cbIntl,
-                        const Callback& cb)
-      {
-        if (CanBeCalled(cbIntl))
-        {
-          cbIntl(this);
-        }
+    return nullptr;
+  }
 
-        if (CanBeCalled(cb))
-        {
-          cb(this);
-        }
-      }
+  //
+  // Mouse checks include right and bottom edges,
+  // so do the cells.
+  //
+  SpatialGrid::CellRange SpatialGrid::CellsOf(const SDL_Rect& rect)
+  {
+    CellRange res;
 
-      void UpdateTransform();
+    int x0 = rect.x;
+    int y0 = rect.y;
+    int x1 = rect.x + rect.w;
+    int y1 = rect.y + rect.h;
 
-      virtual void DrawImpl() = 0;
+    if (x1 < 0 || y1 < 0 || x0 > _w || y0 > _h || x1 < x0 || y1 < y0)
+    {
+      return res;
+    }
 
-      void SetOutline()
-      {
-        _debugOutline = _transform;
+    res.X0 = Clamp(x0, 0, _w) / CellSize;
+    res.Y0 = Clamp(y0, 0, _h) / CellSize;
+    res.X1 = Clamp(x1, 0, _w) / CellSize;
+    res.Y1 = Clamp(y1, 0, _h) / CellSize;
 
-        _debugOutline.x += Manager::Get()._renderDst.x;
-        _debugOutline.y += Manager::Get()._renderDst.y;
-      }
+    return res;
+  }
 
-      void DrawOutline()
+  //
+  // Elements are created in id order, but composite ones
+  // are added to canvas after their parts, so position
+  // in the table has to be searched for.
+  //
+  void ElementTable::Update(Element* e)
+  {
+    int i = e->_tableIndex;
+
+    if (i < 0)
+    {
+      auto byId = [](Element* a, Element* b)
       {
-        SDL_GetRenderDrawColor(_rendRef,
-                              &_oldColor.r,
-                              &_oldColor.g,
-                              &_oldColor.b,
-                              &_oldColor.a);
+        return (a->Id() < b->Id());
+      };
 
-        if (_enabled)
-        {
-          SDL_SetRenderDrawColor(_rendRef, 255, 255, 255, 255);
-        }
-        else
-        {
-          SDL_SetRenderDrawColor(_rendRef, 255, 0, 0, 255);
-        }
+      auto it = std::lower_bound(_elements.begin(), _elements.end(), e, byId);
 
-        SDL_RenderDrawRect(_rendRef, &_debugOutline);
+      i = (int)(it - _elements.begin());
 
-        SDL_RenderDrawLine(_rendRef,
-                           _debugOutline.x,
-                           _debugOutline.y,
-                           _debugOutline.x + _transform.w - 1,
-                           _debugOutline.y + _transform.h - 1);
+      _elements.insert(it, e);
 
-        SDL_RenderDrawLine(_rendRef,
-                           _debugOutline.x,
-                           _debugOutline.y + _transform.h - 1,
-                           _debugOutline.x + _transform.w - 1,
-                           _debugOutline.y);
+      _hitX0.insert(_hitX0.begin() + i, 0);
+      _hitY0.insert(_hitY0.begin() + i, 0);
+      _hitX1.insert(_hitX1.begin() + i, 0);
+      _hitY1.insert(_hitY1.begin() + i, 0);
 
-        SDL_SetRenderDrawColor(_rendRef,
-                               _oldColor.r,
-                               _oldColor.g,
-                               _oldColor.b,
-                               _oldColor.a);
-      }
+      _drawX0.insert(_drawX0.begin() + i, 0);
+      _drawY0.insert(_drawY0.begin() + i, 0);
+      _drawX1.insert(_drawX1.begin() + i, 0);
+      _drawY1.insert(_drawY1.begin() + i, 0);
 
-      void ResetHandlersIntl()
-      {
-        _onMouseDownIntl = std::function<void(Element*)>();
-        _onMouseUpIntl   = std::function<void(Element*)>();
-        _onMouseOverIntl = std::function<void(Element*)>();
-        _onMouseOutIntl  = std::function<void(Element*)>();
-        _onMouseMoveIntl = std::function<void(Element*)>();
-      }
+      _hittable.insert(_hittable.begin() + i, 0);
+      _visible.insert(_visible.begin() + i, 0);
 
-      void RaiseEvent(EventType eventType)
+      for (size_t j = i; j < _elements.size(); j++)
       {
-        switch (eventType)
-        {
-          case EventType::MOUSE_OVER:
-          {
-            CallHandlers(_onMouseOverIntl, OnMouseOver);
-          }
-          break;
-
-          case EventType::MOUSE_OUT:
-          {
-            CallHandlers(_onMouseOutIntl, OnMouseOut);
-          }
-          break;
+        _elements[j]->_tableIndex = (int)j;
+      }
+    }
 
-          case EventType::MOUSE_DOWN:
-          {
-            CallHandlers(_onMouseDownIntl, OnMouseDown);
-          }
-          break;
+    auto& r = e->_localTransform;
 
-          case EventType::MOUSE_UP:
-          {
-            CallHandlers(_onMouseUpIntl, OnMouseUp);
-          }
-          break;
+    _hitX0[i] = r.x;
+    _hitY0[i] = r.y;
+    _hitX1[i] = r.x + r.w;
+    _hitY1[i] = r.y + r.h;
 
-          case EventType::MOUSE_MOVE:
-          {
-            CallHandlers(_onMouseMoveIntl, OnMouseMove);
-          }
-          break;
+    SDL_Rect b = e->DrawBounds();
 
-          default:
-          {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "Unknown event type: %i",
-                        (int)eventType);
-          }
-          break;
-        }
-      }
+    _drawX0[i] = b.x;
+    _drawY0[i] = b.y;
+    _drawX1[i] = b.x + b.w;
+    _drawY1[i] = b.y + b.h;
 
-      SDL_Rect _transform;
-      SDL_Rect _localTransform;
-      SDL_Rect _renderTransform;
-      SDL_Rect _corners;
-      SDL_Rect _debugOutline;
+    _hittable[i] = e->IsEnabledAndVisible() ? -1 : 0;
+    _visible[i]  = e->_visible ? -1 : 0;
+  }
 
-      SDL_Renderer* _rendRef = nullptr;
+  void ElementTable::Remove(Element* e)
+  {
+    int i = e->_tableIndex;
 
-      SDL_Color _oldColor;
+    if (i < 0)
+    {
+      return;
+    }
 
-      uint64_t _id = 0;
+    _elements.erase(_elements.begin() + i);
 
-      bool _mouseEnter = false;
+    _hitX0.erase(_hitX0.begin() + i);
+    _hitY0.erase(_hitY0.begin() + i);
+    _hitX1.erase(_hitX1.begin() + i);
+    _hitY1.erase(_hitY1.begin() + i);
 
-      bool _enabled     = true;
-      bool _visible     = true;
-      bool _showOutline = false;
+    _drawX0.erase(_drawX0.begin() + i);
+    _drawY0.erase(_drawY0.begin() + i);
+    _drawX1.erase(_drawX1.begin() + i);
+    _drawY1.erase(_drawY1.begin() + i);
 
-      std::function<void(Element*)> _onMouseDownIntl;
-      std::function<void(Element*)> _onMouseUpIntl;
-      std::function<void(Element*)> _onMouseOverIntl;
-      std::function<void(Element*)> _onMouseOutIntl;
-      std::function<void(Element*)> _onMouseMoveIntl;
+    _hittable.erase(_hittable.begin() + i);
+    _visible.erase(_visible.begin() + i);
 
-      Canvas* _owner = nullptr;
+    for (size_t j = i; j < _elements.size(); j++)
+    {
+      _elements[j]->_tableIndex = (int)j;
+    }
 
-      friend class Canvas;
-      friend class Manager;
-      friend class Button;
-  };
+    e->_tableIndex = -1;
+  }
 
-// =============================================================================
-//                              CANVAS
-// =============================================================================
-  class Canvas : public Element
+  //
+  // Blocks are checked from the end of the table,
+  // the ones that don't fit into a block are at the beginning.
+  //
+  Element* ElementTable::Find(int x, int y)
   {
-    public:
-      Canvas(const SDL_Rect& transform,
-             SDL_Renderer* rendRef)
-        : Element(nullptr, transform)
-      {
-        _rendRef = rendRef;
-      }
+    int i = (int)_elements.size();
 
-      void HandleEvents(const SDL_Event& evt)
-      {
-        //
-        // Disabled canvas should not handle events at all.
-        //
-        if (!_enabled || !_visible)
-        {
-          return;
-        }
+#if defined(REPAUI_SIMD_AVX2)
+    __m256i vx = _mm256_set1_epi32(x);
+    __m256i vy = _mm256_set1_epi32(y);
 
-        Element::HandleEvents(evt);
+    for (; i >= 8; i -= 8)
+    {
+      int b = i - 8;
 
-        switch (evt.type)
-        {
-          case SDL_MOUSEMOTION:
-          case SDL_MOUSEBUTTONUP:
-          case SDL_MOUSEBUTTONDOWN:
-          {
-            Element* newElement = nullptr;
+      __m256i x0 = _mm256_loadu_si256((const __m256i*)&_hitX0[b]);
+      __m256i y0 = _mm256_loadu_si256((const __m256i*)&_hitY0[b]);
+      __m256i x1 = _mm256_loadu_si256((const __m256i*)&_hitX1[b]);
+      __m256i y1 = _mm256_loadu_si256((const __m256i*)&_hitY1[b]);
+      __m256i on = _mm256_loadu_si256((const __m256i*)&_hittable[b]);
 
-            for (auto it = _elements.rbegin(); it != _elements.rend(); it++)
-            {
-              if (it->second->IsEnabledAndVisible()
-               && it->second->IsMouseInside(evt))
-              {
-                newElement = it->second.get();
-                break;
-              }
-            }
+      __m256i outside = _mm256_or_si256(
+                          _mm256_or_si256(_mm256_cmpgt_epi32(x0, vx),
+                                          _mm256_cmpgt_epi32(vx, x1)),
+                          _mm256_or_si256(_mm256_cmpgt_epi32(y0, vy),
+                                          _mm256_cmpgt_epi32(vy, y1)));
 
-            if (_topElement != newElement)
-            {
-              if (_topElement != nullptr)
-              {
-                _topElement->RaiseEvent(EventType::MOUSE_OUT);
-                _topElement->_mouseEnter = false;
-              }
+      __m256i hit = _mm256_andnot_si256(outside, on);
 
-              _topElement = newElement;
-            }
-          }
-          break;
-        }
+      int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
 
-        if (_topElement != nullptr)
-        {
-          _topElement->HandleEvents(evt);
-        }
+      if (mask != 0)
+      {
+        return _elements[b + HighestBit(mask)];
       }
+    }
+#elif defined(REPAUI_SIMD_SSE2)
+    __m128i vx = _mm_set1_epi32(x);
+    __m128i vy = _mm_set1_epi32(y);
 
-      void SetTransform(const SDL_Rect& transform) override
-      {
-        Element::SetTransform(transform);
-        Element::UpdateTransform();
+    for (; i >= 4; i -= 4)
+    {
+      int b = i - 4;
 
-        for (auto& kvp : _elements)
-        {
-          kvp.second->UpdateTransform();
-        }
-      }
+      __m128i x0 = _mm_loadu_si128((const __m128i*)&_hitX0[b]);
+      __m128i y0 = _mm_loadu_si128((const __m128i*)&_hitY0[b]);
+      __m128i x1 = _mm_loadu_si128((const __m128i*)&_hitX1[b]);
+      __m128i y1 = _mm_loadu_si128((const __m128i*)&_hitY1[b]);
+      __m128i on = _mm_loadu_si128((const __m128i*)&_hittable[b]);
 
-    protected:
-      void DrawImpl() override {}
+      __m128i outside = _mm_or_si128(
+                          _mm_or_si128(_mm_cmpgt_epi32(x0, vx),
+                                       _mm_cmpgt_epi32(vx, x1)),
+                          _mm_or_si128(_mm_cmpgt_epi32(y0, vy),
+                                       _mm_cmpgt_epi32(vy, y1)));
 
-    private:
-      void Draw()
-      {
-        if (!_visible)
-        {
-          return;
-        }
+      __m128i hit = _mm_andnot_si128(outside, on);
 
-        for (auto& kvp : _elements)
-        {
-          kvp.second->Draw();
-        }
+      int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
 
-        if (_showOutline)
-        {
-          DrawOutline();
-        }
+      if (mask != 0)
+      {
+        return _elements[b + HighestBit(mask)];
       }
+    }
+#endif
+
+    while (i > 0)
+    {
+      i--;
 
-      void Clear()
+      if (IsHit(i, x, y))
       {
-        SDL_SetTextureColorMod(Manager::Get()._blankImage, 0, 0, 0);
-        SDL_RenderCopy(_rendRef,
-                       Manager::Get()._blankImage,
-                       nullptr,
-                       &_renderTransform);
+        return _elements[i];
       }
+    }
 
-      Element* Add(Element* e)
+    return nullptr;
+  }
+
+  void ElementTable::Cull(const SDL_Rect& clip, std::vector<int>& res)
+  {
+    res.clear();
+
+    if (SDL_RectEmpty(&clip))
+    {
+      return;
+    }
+
+    int i = (int)_elements.size();
+
+#if defined(REPAUI_SIMD_AVX2)
+    __m256i cx0 = _mm256_set1_epi32(clip.x);
+    __m256i cy0 = _mm256_set1_epi32(clip.y);
+    __m256i cx1 = _mm256_set1_epi32(clip.x + clip.w);
+    __m256i cy1 = _mm256_set1_epi32(clip.y + clip.h);
+
+    for (; i >= 8; i -= 8)
+    {
+      int b = i - 8;
+
+      __m256i x0 = _mm256_loadu_si256((const __m256i*)&_drawX0[b]);
+      __m256i y0 = _mm256_loadu_si256((const __m256i*)&_drawY0[b]);
+      __m256i x1 = _mm256_loadu_si256((const __m256i*)&_drawX1[b]);
+      __m256i y1 = _mm256_loadu_si256((const __m256i*)&_drawY1[b]);
+      __m256i on = _mm256_loadu_si256((const __m256i*)&_visible[b]);
+
+      __m256i notEmpty = _mm256_and_si256(_mm256_cmpgt_epi32(x1, x0),
+                                          _mm256_cmpgt_epi32(y1, y0));
+
+      __m256i overlaps = _mm256_and_si256(
+                           _mm256_and_si256(_mm256_cmpgt_epi32(cx1, x0),
+                                            _mm256_cmpgt_epi32(x1, cx0)),
+                           _mm256_and_si256(_mm256_cmpgt_epi32(cy1, y0),
+                                            _mm256_cmpgt_epi32(y1, cy0)));
+
+      __m256i drawn = _mm256_and_si256(on, _mm256_and_si256(notEmpty, overlaps));
+
+      int mask = _mm256_movemask_ps(_mm256_castsi256_ps(drawn));
+
+      for (int bit = 7; bit >= 0; bit--)
       {
-        if (e == nullptr)
+        if (mask & (1 << bit))
         {
-          SDL_LogError(SDL_LOG_CATEGORY_ERROR,
-                       "Trying to add null to canvas!");
-          return nullptr;
+          res.push_back(b + bit);
         }
-
-        uint64_t id = e->Id();
-        _elements[id].reset(e);
-
-        return _elements[id].get();
       }
+    }
+#elif defined(REPAUI_SIMD_SSE2)
+    __m128i cx0 = _mm_set1_epi32(clip.x);
+    __m128i cy0 = _mm_set1_epi32(clip.y);
+    __m128i cx1 = _mm_set1_epi32(clip.x + clip.w);
+    __m128i cy1 = _mm_set1_epi32(clip.y + clip.h);
 
-      bool IsOutsideCanvas(const SDL_Rect& transform)
-      {
-        bool cond = ((transform.x + transform.w) < _transform.x)
-                 || ((transform.y + transform.h) < _transform.y)
-                 || (transform.x > (_transform.x + _transform.w))
-                 || (transform.y > (_transform.y + _transform.h));
+    for (; i >= 4; i -= 4)
+    {
+      int b = i - 4;
 
-        return cond;
-      }
+      __m128i x0 = _mm_loadu_si128((const __m128i*)&_drawX0[b]);
+      __m128i y0 = _mm_loadu_si128((const __m128i*)&_drawY0[b]);
+      __m128i x1 = _mm_loadu_si128((const __m128i*)&_drawX1[b]);
+      __m128i y1 = _mm_loadu_si128((const __m128i*)&_drawY1[b]);
+      __m128i on = _mm_loadu_si128((const __m128i*)&_visible[b]);
 
-      std::map<uint64_t, std::unique_ptr<Element>> _elements;
+      __m128i notEmpty = _mm_and_si128(_mm_cmpgt_epi32(x1, x0),
+                                       _mm_cmpgt_epi32(y1, y0));
 
-      Element* _topElement = nullptr;
+      __m128i overlaps = _mm_and_si128(
+                           _mm_and_si128(_mm_cmpgt_epi32(cx1, x0),
+                                         _mm_cmpgt_epi32(x1, cx0)),
+                           _mm_and_si128(_mm_cmpgt_epi32(cy1, y0),
+                                         _mm_cmpgt_epi32(y1, cy0)));
 
-      friend class Manager;
-  };
+      __m128i drawn = _mm_and_si128(on, _mm_and_si128(notEmpty, overlaps));
 
-// =============================================================================
-//                             DEFINITIONS
-// =============================================================================
-  Element::Element(Canvas* parent,
-                   const SDL_Rect& transform)
-  {
-    _owner   = parent;
-    _rendRef = Manager::Get()._rendRef;
+      int mask = _mm_movemask_ps(_mm_castsi128_ps(drawn));
 
-    _id = Manager::Get().GetNewId();
+      for (int bit = 3; bit >= 0; bit--)
+      {
+        if (mask & (1 << bit))
+        {
+          res.push_back(b + bit);
+        }
+      }
+    }
+#endif
 
-    SetTransform(transform);
-    UpdateTransform();
-  }
+    while (i > 0)
+    {
+      i--;
 
-  void Element::SetTransform(const SDL_Rect& transform)
-  {
-    _localTransform = transform;
-    UpdateTransform();
+      if (IsDrawn(i, clip))
+      {
+        res.push_back(i);
+      }
+    }
   }
 
-  void Element::UpdateTransform()
+  void Element::Damage(const SDL_Rect& rect)
   {
+    if (_destroyed)
+    {
+      return;
+    }
+
     if (_owner == nullptr)
     {
-      _transform = _localTransform;
+      Manager::Get().AddDamage(rect);
     }
     else
     {
-      auto& pt = _owner->Transform();
-
-      _transform.x = _localTransform.x + pt.x;
-      _transform.y = _localTransform.y + pt.y;
-      _transform.w = _localTransform.w;
-      _transform.h = _localTransform.h;
+      _owner->AddDamage(rect);
     }
-
-    _renderTransform = Manager::Get()._renderDst;
-
-    _renderTransform.x += _transform.x;
-    _renderTransform.y += _transform.y;
-    _renderTransform.w = _transform.w;
-    _renderTransform.h = _transform.h;
-
-    SetOutline();
   }
 
   bool Element::IsMouseInside(const SDL_Event& evt)
@@ -944,18 +3882,43 @@ namespace RepaUI
             const SDL_Rect& transform)
         : Element(owner, transform)
       {
-        _image = (image == nullptr)
-                ? Manager::Get()._blankImage
-                : image;
+        if (image == nullptr)
+        {
+          _image    = Manager::Get()._atlas;
+          _imageSrc = Manager::Get()._blankImageSrc;
+
+          _opaqueSource = true;
+        }
+        else
+        {
+          _image = image;
+
+          _imageSrc.x = 0;
+          _imageSrc.y = 0;
+
+          SDL_QueryTexture(_image,
+                           nullptr,
+                           nullptr,
+                           &_imageSrc.w,
+                           &_imageSrc.h);
+        }
+
+        SetTileRate({ 1, 1 });
 
-        _imageSrc.x = 0;
-        _imageSrc.y = 0;
+        _color = { 255, 255, 255, 255 };
+      }
 
-        SDL_QueryTexture(_image,
-                         nullptr,
-                         nullptr,
-                         &_imageSrc.w,
-                         &_imageSrc.h);
+      //
+      // For images that are only part of the texture.
+      //
+      Image(Canvas* owner,
+            SDL_Texture* image,
+            const SDL_Rect& transform,
+            const SDL_Rect& imageSrc)
+        : Element(owner, transform)
+      {
+        _image    = image;
+        _imageSrc = imageSrc;
 
         SetTileRate({ 1, 1 });
 
@@ -965,6 +3928,16 @@ namespace RepaUI
       void SetColor(const SDL_Color& color)
       {
         _color = color;
+
+        //
+        // Slice geometry has color in it.
+        //
+        if (_slice != nullptr)
+        {
+          _slice->FragmentsDirty = true;
+        }
+
+        Invalidate();
       }
 
       const SDL_Color& GetColor()
@@ -977,6 +3950,8 @@ namespace RepaUI
         _blendMode = isSet
                      ? SDL_BLENDMODE_BLEND
                      : SDL_BLENDMODE_NONE;
+
+        Invalidate();
       }
 
       const std::pair<size_t, size_t>& GetTileRate()
@@ -992,6 +3967,8 @@ namespace RepaUI
         _tileRate.second = Clamp<size_t>(_tileRate.second, 1, _localTransform.h);
 
         CalculateSteps();
+
+        Invalidate();
       }
 
       void SetSlicePoints(const SDL_Rect& slicePoints)
@@ -1029,6 +4006,13 @@ namespace RepaUI
           _slicePoints.h = _slicePoints.y;
         }
 
+        if (_slice == nullptr)
+        {
+          _slice = std::make_unique<SliceData>();
+        }
+
+        auto& slices = _slice->Slices;
+
         //
         //  --- --- ---
         // | 0 | 1 | 2 |
@@ -1043,30 +4027,82 @@ namespace RepaUI
         // and since _slicePoints are absolute,
         // sometimes we need to add 1 for certain slices.
         //
-        _slices[0] = { 0, 0, _slicePoints.x, _slicePoints.y };
-        _slices[1] = { _slicePoints.x, 0, _slicePoints.w + 1, _slicePoints.y };
-        _slices[2] = { _slicePoints.w + 1, 0, _imageSrc.w, _slicePoints.y };
-        _slices[3] = { 0, _slicePoints.y, _slicePoints.x, _slicePoints.h + 1 };
-        _slices[4] = { _slicePoints.x, _slicePoints.y, _slicePoints.w + 1, _slicePoints.h + 1 };
-        _slices[5] = { _slicePoints.w + 1, _slicePoints.y, _imageSrc.w, _slicePoints.h + 1 };
-        _slices[6] = { 0, _slicePoints.h + 1, _slicePoints.x, _imageSrc.h };
-        _slices[7] = { _slicePoints.x, _slicePoints.h + 1, _slicePoints.w + 1, _imageSrc.h };
-        _slices[8] = { _slicePoints.w + 1, _slicePoints.h + 1, _imageSrc.w, _imageSrc.h };
+        slices[0] = { 0, 0, _slicePoints.x, _slicePoints.y };
+        slices[1] = { _slicePoints.x, 0, _slicePoints.w + 1, _slicePoints.y };
+        slices[2] = { _slicePoints.w + 1, 0, _imageSrc.w, _slicePoints.y };
+        slices[3] = { 0, _slicePoints.y, _slicePoints.x, _slicePoints.h + 1 };
+        slices[4] = { _slicePoints.x, _slicePoints.y, _slicePoints.w + 1, _slicePoints.h + 1 };
+        slices[5] = { _slicePoints.w + 1, _slicePoints.y, _imageSrc.w, _slicePoints.h + 1 };
+        slices[6] = { 0, _slicePoints.h + 1, _slicePoints.x, _imageSrc.h };
+        slices[7] = { _slicePoints.x, _slicePoints.h + 1, _slicePoints.w + 1, _imageSrc.h };
+        slices[8] = { _slicePoints.w + 1, _slicePoints.h + 1, _imageSrc.w, _imageSrc.h };
 
-        for (auto& i : _slices)
+        for (size_t i = 0; i < 9; i++)
         {
-          _swh.push_back({ i.w - i.x - 1, i.h - i.y - 1 });
+          auto& sl = slices[i];
+
+          _slice->Swh[i] = { sl.w - sl.x - 1, sl.h - sl.y - 1 };
+
+          _slice->Src[i] =
+          {
+            _imageSrc.x + sl.x,
+            _imageSrc.y + sl.y,
+            sl.w - sl.x,
+            sl.h - sl.y
+          };
         }
 
-        CalculateFragments();
+        _slice->FragmentsDirty = true;
+
+        Invalidate();
       }
 
       void SetDrawType(DrawType drawType)
       {
         _drawType = drawType;
+        Invalidate();
+      }
+
+      //
+      // Tells that image has no transparent pixels,
+      // so it can hide whatever is beneath it.
+      //
+      void SetOpaqueSource(bool isSet)
+      {
+        _opaqueSource = isSet;
+        Invalidate();
       }
 
     protected:
+      bool IsOccluder() override
+      {
+        return (CoversTransform()
+             && (_blendMode == SDL_BLENDMODE_NONE || IsOpaque()));
+      }
+
+      bool IsOpaque() override
+      {
+        return (_opaqueSource
+             && _color.a == 255
+             && (_blendMode == SDL_BLENDMODE_NONE
+              || _blendMode == SDL_BLENDMODE_BLEND)
+             && CoversTransform());
+      }
+
+      bool CanLowerAlpha() override
+      {
+        return (_blendMode == SDL_BLENDMODE_NONE && !IsOpaque());
+      }
+
+      void ReleaseTextures() override
+      {
+        if (_pattern != nullptr)
+        {
+          Manager::Get().DestroyTexture(_pattern);
+          _pattern = nullptr;
+        }
+      }
+
       void DrawImpl() override
       {
         //
@@ -1074,9 +4110,11 @@ namespace RepaUI
         // so if several elements share the same texture,
         // the properties for it will also be shared.
         //
-        SDL_SetTextureBlendMode(_image, _blendMode);
-        SDL_SetTextureColorMod(_image, _color.r, _color.g, _color.b);
-        SDL_SetTextureAlphaMod(_image, _color.a);
+        auto& rs = Manager::Get()._renderState;
+
+        rs.SetTextureBlendMode(_image, _blendMode);
+        rs.SetTextureColorMod(_image, _color.r, _color.g, _color.b);
+        rs.SetTextureAlphaMod(_image, _color.a);
 
         switch (_drawType)
         {
@@ -1108,12 +4146,60 @@ namespace RepaUI
       }
 
     private:
+      //
+      // Sliced image leaves gaps if element is smaller
+      // than its corners combined.
+      //
+      bool CoversTransform()
+      {
+        if (_drawType != DrawType::SLICED || !IsSet(_slicePoints))
+        {
+          return true;
+        }
+
+        UpdateFragments();
+
+        for (auto& f : _slice->Fragments)
+        {
+          if (f.w < 0 || f.h < 0)
+          {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
       void CalculateSteps()
       {
         _stepX = _localTransform.w / _tileRate.first;
         _stepY = _localTransform.h / _tileRate.second;
       }
 
+      //
+      // Slices only depend on slice points and element's size and position,
+      // so they're recalculated only when one of those has changed.
+      //
+      void UpdateFragments()
+      {
+        auto& sd = *_slice;
+
+        if (!sd.FragmentsDirty
+         && SDL_RectEquals(&sd.FragmentsTransform, &_renderTransform))
+        {
+          return;
+        }
+
+        sd.FragmentsDirty     = false;
+        sd.FragmentsTransform = _renderTransform;
+
+        CalculateFragments();
+
+#ifdef REPAUI_RENDER_GEOMETRY
+        BuildSliceGeometry();
+#endif
+      }
+
       void CalculateFragments()
       {
         //
@@ -1135,83 +4221,300 @@ namespace RepaUI
         // I kinda fucked myself over
         // by misusing SDL_Rect for storing coordinates.
         //
-        _fragments[0] = { coords.x, coords.y, _swh[0].first, _swh[0].second };
-        _fragments[1] = { coords.x + _swh[0].first, coords.y, t.w - (_swh[0].first + _swh[2].first), _swh[0].second };
-        _fragments[2] = { coords.w - _swh[2].first, coords.y, _swh[2].first, _swh[2].second };
-        _fragments[3] = { coords.x, coords.y + _swh[0].second, _swh[0].first, t.h - (_swh[0].second + _swh[6].second) };
-        _fragments[4] = { coords.x + _swh[0].first, coords.y + _swh[0].second, t.w - (_swh[0].first + _swh[2].first), t.h - (_swh[0].second + _swh[6].second) };
-        _fragments[5] = { coords.w - _swh[2].first, coords.y + _swh[0].second, _swh[2].first, t.h - (_swh[0].second + _swh[6].second) };
-        _fragments[6] = { coords.x, coords.h - _swh[6].second, _swh[0].first, _swh[6].second };
-        _fragments[7] = { coords.x + _swh[0].first, coords.h - _swh[6].second, t.w - (_swh[0].first + _swh[2].first), _swh[6].second };
-        _fragments[8] = { coords.w - _swh[2].first, coords.h - _swh[6].second, _swh[2].first, _swh[6].second };
+        auto& swh = _slice->Swh;
+        auto& fr  = _slice->Fragments;
+
+        fr[0] = { coords.x, coords.y, swh[0].first, swh[0].second };
+        fr[1] = { coords.x + swh[0].first, coords.y, t.w - (swh[0].first + swh[2].first), swh[0].second };
+        fr[2] = { coords.w - swh[2].first, coords.y, swh[2].first, swh[2].second };
+        fr[3] = { coords.x, coords.y + swh[0].second, swh[0].first, t.h - (swh[0].second + swh[6].second) };
+        fr[4] = { coords.x + swh[0].first, coords.y + swh[0].second, t.w - (swh[0].first + swh[2].first), t.h - (swh[0].second + swh[6].second) };
+        fr[5] = { coords.w - swh[2].first, coords.y + swh[0].second, swh[2].first, t.h - (swh[0].second + swh[6].second) };
+        fr[6] = { coords.x, coords.h - swh[6].second, swh[0].first, swh[6].second };
+        fr[7] = { coords.x + swh[0].first, coords.h - swh[6].second, t.w - (swh[0].first + swh[2].first), swh[6].second };
+        fr[8] = { coords.w - swh[2].first, coords.h - swh[6].second, swh[2].first, swh[6].second };
       }
 
       void DrawNormal()
       {
         SDL_RenderCopy(_rendRef,
                         _image,
-                        nullptr,
+                        &_imageSrc,
                         &_renderTransform);
       }
 
       void DrawSliced()
       {
-        CalculateFragments();
+        UpdateFragments();
 
-        for (size_t i = 0; i < 9; i++)
+        auto& sd = *_slice;
+
+#ifdef REPAUI_RENDER_GEOMETRY
+        if (sd.IndicesCount == 0)
         {
-          _tempRect =
-          {
-            _slices[i].x,
-            _slices[i].y,
-            _slices[i].w - _slices[i].x,
-            _slices[i].h - _slices[i].y
-          };
+          return;
+        }
+
+        //
+        // Color is baked into vertices.
+        //
+        auto& rs = Manager::Get()._renderState;
+
+        rs.SetTextureColorMod(_image, 255, 255, 255);
+        rs.SetTextureAlphaMod(_image, 255);
 
+        SDL_RenderGeometry(_rendRef,
+                           _image,
+                           sd.Vertices,
+                           sd.VerticesCount,
+                           sd.Indices,
+                           sd.IndicesCount);
+#else
+        for (size_t i = 0; i < 9; i++)
+        {
           SDL_RenderCopy(_rendRef,
                           _image,
-                          &_tempRect,
-                          &_fragments[i]);
+                          &sd.Src[i],
+                          &sd.Fragments[i]);
+        }
+#endif
+      }
+
+#ifdef REPAUI_RENDER_GEOMETRY
+
+      //
+      // Two triangles per slice, all nine are submitted in one call.
+      // Empty slices are skipped, just like SDL_RenderCopy() does.
+      //
+      void BuildSliceGeometry()
+      {
+        auto& sd = *_slice;
+
+        sd.VerticesCount = 0;
+        sd.IndicesCount  = 0;
+
+        int tw = 0;
+        int th = 0;
+
+        SDL_QueryTexture(_image, nullptr, nullptr, &tw, &th);
+
+        if (tw == 0 || th == 0)
+        {
+          return;
+        }
+
+        for (size_t i = 0; i < 9; i++)
+        {
+          auto& src = sd.Src[i];
+          auto& dst = sd.Fragments[i];
+
+          if (SDL_RectEmpty(&src) || SDL_RectEmpty(&dst))
+          {
+            continue;
+          }
+
+          float x0 = dst.x;
+          float y0 = dst.y;
+          float x1 = dst.x + dst.w;
+          float y1 = dst.y + dst.h;
+
+          float u0 = (float)src.x / tw;
+          float v0 = (float)src.y / th;
+          float u1 = (float)(src.x + src.w) / tw;
+          float v1 = (float)(src.y + src.h) / th;
+
+          int base = sd.VerticesCount;
+
+          sd.Vertices[base + 0] = { { x0, y0 }, _color, { u0, v0 } };
+          sd.Vertices[base + 1] = { { x1, y0 }, _color, { u1, v0 } };
+          sd.Vertices[base + 2] = { { x0, y1 }, _color, { u0, v1 } };
+          sd.Vertices[base + 3] = { { x1, y1 }, _color, { u1, v1 } };
+
+          sd.VerticesCount += 4;
+
+          int* ind = &sd.Indices[sd.IndicesCount];
+
+          ind[0] = base + 0;
+          ind[1] = base + 1;
+          ind[2] = base + 2;
+          ind[3] = base + 2;
+          ind[4] = base + 1;
+          ind[5] = base + 3;
+
+          sd.IndicesCount += 6;
         }
       }
 
+#endif
+
+      //
+      // Tiles are drawn into cached pattern texture once,
+      // so drawing is always a single copy no matter the tile rate.
+      //
       void DrawTiled()
+      {
+        UpdatePattern();
+
+        if (_pattern == nullptr)
+        {
+          return;
+        }
+
+        auto& rs = Manager::Get()._renderState;
+
+        rs.SetTextureBlendMode(_pattern, _blendMode);
+        rs.SetTextureColorMod(_pattern, _color.r, _color.g, _color.b);
+        rs.SetTextureAlphaMod(_pattern, _color.a);
+
+        SDL_Rect src = { 0, 0, _patternW, _patternH };
+
+        SDL_RenderCopy(_rendRef,
+                       _pattern,
+                       &src,
+                       &_renderTransform);
+      }
+
+      //
+      // Pattern is rebuilt only if size or tile rate has changed.
+      // Single tile is drawn first and then the filled area is doubled
+      // horizontally and vertically, ping-ponging between pattern
+      // and scratch texture, since texture can't be copied onto itself.
+      //
+      void UpdatePattern()
       {
         CalculateSteps();
 
-        Manager::Get().PushClipRect();
+        int w = _transform.w;
+        int h = _transform.h;
 
-        auto old = SDL_GetRenderTarget(_rendRef);
-        SDL_SetRenderTarget(_rendRef, Manager::Get()._renderTempTexture);
-        SDL_RenderClear(_rendRef);
+        if (w <= 0 || h <= 0)
+        {
+          return;
+        }
 
-        _tempRect = { 0, 0, _transform.w, _transform.h };
+        bool sizeChanged = (w != _patternW || h != _patternH);
 
-        SDL_RenderSetClipRect(_rendRef, &_tempRect);
+        if (_pattern != nullptr
+         && !sizeChanged
+         && _patternStepX == _stepX
+         && _patternStepY == _stepY
+         && _patternGeneration == Manager::Get()._targetsGeneration)
+        {
+          return;
+        }
 
-        for (int x = 0; x < _transform.w; x += _stepX)
+        if (_pattern == nullptr || sizeChanged)
         {
-          for (int y = 0; y < _transform.h; y += _stepY)
+          if (_pattern != nullptr)
           {
-            _tempRect = { x, y, _stepX, _stepY };
+            Manager::Get().DestroyTexture(_pattern);
+          }
 
-            SDL_RenderCopy(_rendRef,
-                           _image,
-                           nullptr,
-                           &_tempRect);
+          _patternW = w;
+          _patternH = h;
+
+          _pattern = Manager::Get().CreateRenderTexture(_patternW, _patternH);
+
+          if (_pattern == nullptr)
+          {
+            SDL_Log("%s", SDL_GetError());
+            return;
           }
         }
 
-        SDL_SetRenderTarget(_rendRef, old);
+        SDL_Texture* from    = _pattern;
+        SDL_Texture* to      = nullptr;
+        SDL_Texture* scratch = nullptr;
 
-        Manager::Get().PopClipRect();
+        if (_stepX < w || _stepY < h)
+        {
+          scratch = Manager::Get().CreateRenderTexture(_patternW, _patternH);
+          if (scratch == nullptr)
+          {
+            SDL_Log("%s", SDL_GetError());
+          }
+        }
 
-        _tempRect = { 0, 0, _transform.w, _transform.h };
+        auto& rs = Manager::Get()._renderState;
 
-        SDL_RenderCopy(_rendRef,
-                       Manager::Get()._renderTempTexture,
-                       &_tempRect,
-                       &_renderTransform);
+        auto old = rs.GetRenderTarget();
+
+        //
+        // Pattern keeps image's pixels as they are,
+        // color and blending are applied when it's drawn.
+        //
+        rs.SetTextureBlendMode(_image, SDL_BLENDMODE_NONE);
+        rs.SetTextureColorMod(_image, 255, 255, 255);
+        rs.SetTextureAlphaMod(_image, 255);
+
+        rs.SetRenderTarget(_pattern);
+        rs.SetClipRect(nullptr);
+
+        SDL_Rect src = { 0, 0, _stepX, _stepY };
+        SDL_Rect dst = src;
+
+        SDL_RenderCopy(_rendRef, _image, &_imageSrc, &dst);
+
+        int filledW = _stepX;
+        int filledH = _stepY;
+
+        while (scratch != nullptr && (filledW < w || filledH < h))
+        {
+          bool horizontal = (filledW < w);
+
+          to = (from == _pattern) ? scratch : _pattern;
+
+          rs.SetTextureBlendMode(from, SDL_BLENDMODE_NONE);
+          rs.SetTextureColorMod(from, 255, 255, 255);
+          rs.SetTextureAlphaMod(from, 255);
+
+          rs.SetRenderTarget(to);
+          rs.SetClipRect(nullptr);
+
+          src = { 0, 0, std::min(filledW, w), std::min(filledH, h) };
+          dst = src;
+
+          SDL_RenderCopy(_rendRef, from, &src, &dst);
+
+          if (horizontal)
+          {
+            dst.x += src.w;
+            filledW *= 2;
+          }
+          else
+          {
+            dst.y += src.h;
+            filledH *= 2;
+          }
+
+          SDL_RenderCopy(_rendRef, from, &src, &dst);
+
+          from = to;
+        }
+
+        rs.SetRenderTarget(old);
+
+        Manager::Get().ApplyClipRect();
+
+        //
+        // Whichever texture got the last pass becomes the pattern.
+        //
+        if (scratch != nullptr)
+        {
+          if (from == scratch)
+          {
+            Manager::Get().DestroyTexture(_pattern);
+            _pattern = scratch;
+          }
+          else
+          {
+            Manager::Get().DestroyTexture(scratch);
+          }
+        }
+
+        _patternStepX      = _stepX;
+        _patternStepY      = _stepY;
+        _patternGeneration = Manager::Get()._targetsGeneration;
       }
 
       DrawType _drawType = DrawType::NORMAL;
@@ -1219,17 +4522,49 @@ namespace RepaUI
       SDL_BlendMode _blendMode = SDL_BLENDMODE_NONE;
 
       SDL_Texture* _image = nullptr;
+      SDL_Texture* _pattern = nullptr;
+
+      bool _opaqueSource = false;
+
+      int _patternW = 0;
+      int _patternH = 0;
+      int _patternStepX = 0;
+      int _patternStepY = 0;
+
+      uint64_t _patternGeneration = 0;
 
       SDL_Rect _imageSrc;
-      SDL_Rect _tempRect;
-      SDL_Rect _slices[9];
-      SDL_Rect _fragments[9];
-      SDL_Rect _slicePoints;
+      SDL_Rect _slicePoints = { 0, 0, 0, 0 };
+
+      //
+      // Allocated when slice points are set,
+      // plain images don't need any of it.
+      //
+      struct SliceData
+      {
+        SDL_Rect Slices[9];
+        SDL_Rect Src[9];
+        SDL_Rect Fragments[9];
+        SDL_Rect FragmentsTransform = { 0, 0, 0, 0 };
+
+        std::pair<int, int> Swh[9];
+
+        bool FragmentsDirty = true;
+
+#ifdef REPAUI_RENDER_GEOMETRY
+        SDL_Vertex Vertices[9 * 4];
+        int Indices[9 * 6];
+
+        int VerticesCount = 0;
+        int IndicesCount  = 0;
+#endif
+      };
+
+      std::unique_ptr<SliceData> _slice;
 
       SDL_Color _color;
 
       std::pair<size_t, size_t> _tileRate;
-      std::vector<std::pair<int, int>> _swh;
 
       int _stepX = 1;
       int _stepY = 1;
@@ -1266,64 +4601,188 @@ namespace RepaUI
         _scale = 1.0f;
 
         StoreLines();
+
+        Invalidate();
       }
 
       void SetAlignment(AlignmentH alH, AlignmentV alV)
       {
+        Invalidate();
+
         _alignmentH = alH;
         _alignmentV = alV;
+
+        Invalidate();
       }
 
       void SetColor(const SDL_Color& c)
       {
         _color = c;
+        _cacheDirty = true;
+        Invalidate();
       }
 
       void SetScale(uint8_t scale)
       {
+        Invalidate();
+
         _scale = scale;
         _scale = Clamp<uint8_t>(_scale, 1, 255);
+        _cacheDirty = true;
+
+        Invalidate();
+      }
+
+      void SetText(const std::string& text)
+      {
+        Invalidate();
+
+        _text = text;
+
+        StoreLines();
+
+        _cacheDirty = true;
+
+        Invalidate();
+      }
+
+      const std::string& GetText()
+      {
+        return _text;
+      }
+
+    protected:
+      void DrawImpl() override
+      {
+        UpdateCache();
+
+        if (_cache == nullptr)
+        {
+          return;
+        }
+
+        CalculateDstRect();
+
+        _srcTexture = { 0, 0, _cacheW, _cacheH };
+
+        _dstFinal.w = _cacheW;
+        _dstFinal.h = _cacheH;
+
+        SDL_RenderCopy(_rendRef,
+                       _cache,
+                       &_srcTexture,
+                       &_dstFinal);
       }
 
-      void SetText(const std::string& text)
+      SDL_Rect DrawBounds() override
       {
-        _text = text;
-
-        StoreLines();
+        CalculateDstRect();
+        return _dstFinal;
       }
 
-      const std::string& GetText()
+      void ReleaseTextures() override
       {
-        return _text;
+        if (_cache != nullptr)
+        {
+          Manager::Get().DestroyTexture(_cache);
+          _cache = nullptr;
+        }
       }
 
-    protected:
-      void DrawImpl() override
+    private:
+      //
+      // Rasterizes visible part of the text into private texture,
+      // but only if something that affects the result has changed.
+      //
+      void UpdateCache()
       {
-        SDL_SetTextureColorMod(Manager::Get()._font,
-                               _color.r,
-                               _color.g,
-                               _color.b);
+        auto& fw = Manager::Get().FontW;
+        auto& fh = Manager::Get().FontH;
+
+        int w = std::min<int>(_textMaxStringLen * fw * _scale, _transform.w);
+        int h = std::min<int>(_textLines.size() * fh * _scale, _transform.h);
+
+        //
+        // Nothing to show, so old contents must not be drawn either.
+        //
+        if (w <= 0 || h <= 0)
+        {
+          ReleaseTextures();
+          return;
+        }
+
+        bool sizeChanged = (w != _cacheW || h != _cacheH);
+
+        if (_cache != nullptr
+         && !sizeChanged
+         && !_cacheDirty
+         && _cacheGeneration == Manager::Get()._targetsGeneration)
+        {
+          return;
+        }
+
+        if (_cache == nullptr || sizeChanged)
+        {
+          if (_cache != nullptr)
+          {
+            Manager::Get().DestroyTexture(_cache);
+          }
 
-        Manager::Get().PushClipRect();
+          _cacheW = w;
+          _cacheH = h;
 
-        auto old = SDL_GetRenderTarget(_rendRef);
-        SDL_SetRenderTarget(_rendRef, Manager::Get()._renderTempTexture);
-        SDL_SetTextureBlendMode(Manager::Get()._renderTempTexture,
-                                SDL_BLENDMODE_BLEND);
-        SDL_SetRenderDrawColor(_rendRef, 0, 0, 0, 0);
+          _cache = Manager::Get().CreateRenderTexture(_cacheW, _cacheH);
+        }
+
+        auto& rs = Manager::Get()._renderState;
+
+        auto old = rs.GetRenderTarget();
+        rs.SetRenderTarget(_cache);
+        rs.SetClipRect(nullptr);
+        rs.SetDrawColor(0, 0, 0, 0);
         SDL_RenderClear(_rendRef);
 
-        _srcTexture = { 0, 0, _transform.w, _transform.h };
+        //
+        // Font shares texture with other built-in images,
+        // which may have changed its properties.
+        //
+        auto atlas = Manager::Get()._atlas;
+
+        rs.SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+        rs.SetTextureAlphaMod(atlas, 255);
+
+#ifdef REPAUI_RENDER_GEOMETRY
+
+        if (_cacheDirty || sizeChanged)
+        {
+          BuildGlyphGeometry();
+        }
+
+        rs.SetTextureColorMod(atlas, 255, 255, 255);
+
+        DrawTextGeometry();
 
-        SDL_RenderSetClipRect(_rendRef, &_srcTexture);
+#else
+
+        rs.SetTextureColorMod(atlas,
+                              _color.r,
+                              _color.g,
+                              _color.b);
 
         DrawText();
 
-        SDL_SetRenderTarget(_rendRef, old);
+#endif
 
-        Manager::Get().PopClipRect();
+        rs.SetRenderTarget(old);
+
+        Manager::Get().ApplyClipRect();
+
+        _cacheDirty      = false;
+        _cacheGeneration = Manager::Get()._targetsGeneration;
+      }
 
+      void CalculateDstRect()
+      {
         _dstFinal =
         {
           _renderTransform.x,
@@ -1361,14 +4820,8 @@ namespace RepaUI
           }
           break;
         }
-
-        SDL_RenderCopy(_rendRef,
-                       Manager::Get()._renderTempTexture,
-                       &_srcTexture,
-                       &_dstFinal);
       }
 
-    private:
       void StoreLines()
       {
         _textLines.clear();
@@ -1413,8 +4866,21 @@ namespace RepaUI
 
         for (auto& line : _textLines)
         {
+          //
+          // Glyphs outside of the cache would be clipped anyway.
+          //
+          if (offsetY >= _cacheH)
+          {
+            break;
+          }
+
           for (auto& c : line)
           {
+            if (offsetX >= _cacheW)
+            {
+              break;
+            }
+
             auto gi = Manager::Get().GetCharData(c);
 
             _glyphSrc = { gi->X, gi->Y, fw, fh };
@@ -1428,7 +4894,7 @@ namespace RepaUI
             };
 
             SDL_RenderCopy(_rendRef,
-                           Manager::Get()._font,
+                           Manager::Get()._atlas,
                           &_glyphSrc,
                           &_glyphDst);
 
@@ -1440,6 +4906,92 @@ namespace RepaUI
         }
       }
 
+#ifdef REPAUI_RENDER_GEOMETRY
+
+      //
+      // Builds two triangles per glyph for the whole text,
+      // with text color baked into vertices,
+      // so shared font texture's color mod stays neutral.
+      //
+      void BuildGlyphGeometry()
+      {
+        _glyphVertices.clear();
+        _glyphIndices.clear();
+
+        auto& fw = Manager::Get().FontW;
+        auto& fh = Manager::Get().FontH;
+
+        float atlasW = Manager::Get()._atlasW;
+        float atlasH = Manager::Get()._atlasH;
+
+        float gw = fw * _scale;
+        float gh = fh * _scale;
+
+        SDL_Color c = { _color.r, _color.g, _color.b, 255 };
+
+        float offsetY = 0.0f;
+
+        for (auto& line : _textLines)
+        {
+          if (offsetY >= _cacheH)
+          {
+            break;
+          }
+
+          float offsetX = 0.0f;
+
+          for (auto& ch : line)
+          {
+            if (offsetX >= _cacheW)
+            {
+              break;
+            }
+
+            auto gi = Manager::Get().GetCharData(ch);
+
+            float u0 = gi->X / atlasW;
+            float v0 = gi->Y / atlasH;
+            float u1 = (gi->X + fw) / atlasW;
+            float v1 = (gi->Y + fh) / atlasH;
+
+            int base = _glyphVertices.size();
+
+            _glyphVertices.push_back({ { offsetX,      offsetY      }, c, { u0, v0 } });
+            _glyphVertices.push_back({ { offsetX + gw, offsetY      }, c, { u1, v0 } });
+            _glyphVertices.push_back({ { offsetX,      offsetY + gh }, c, { u0, v1 } });
+            _glyphVertices.push_back({ { offsetX + gw, offsetY + gh }, c, { u1, v1 } });
+
+            _glyphIndices.push_back(base + 0);
+            _glyphIndices.push_back(base + 1);
+            _glyphIndices.push_back(base + 2);
+            _glyphIndices.push_back(base + 2);
+            _glyphIndices.push_back(base + 1);
+            _glyphIndices.push_back(base + 3);
+
+            offsetX += gw;
+          }
+
+          offsetY += gh;
+        }
+      }
+
+      void DrawTextGeometry()
+      {
+        if (_glyphIndices.empty())
+        {
+          return;
+        }
+
+        SDL_RenderGeometry(_rendRef,
+                           Manager::Get()._atlas,
+                           _glyphVertices.data(),
+                           _glyphVertices.size(),
+                           _glyphIndices.data(),
+                           _glyphIndices.size());
+      }
+
+#endif
+
       std::string _text;
 
       std::vector<std::string> _textLines;
@@ -1451,6 +5003,20 @@ namespace RepaUI
       SDL_Rect _srcTexture;
       SDL_Rect _dstFinal;
 
+      SDL_Texture* _cache = nullptr;
+
+      int _cacheW = 0;
+      int _cacheH = 0;
+
+      bool _cacheDirty = true;
+
+      uint64_t _cacheGeneration = 0;
+
+#ifdef REPAUI_RENDER_GEOMETRY
+      std::vector<SDL_Vertex> _glyphVertices;
+      std::vector<int> _glyphIndices;
+#endif
+
       uint8_t _scale = 1;
 
       size_t _textMaxStringLen = 0;
@@ -1480,22 +5046,26 @@ namespace RepaUI
       {
         using namespace std::placeholders;
 
-        std::map<ButtonState, SDL_Texture*> images =
+        std::map<ButtonState, SDL_Rect> images =
         {
-          { ButtonState::NORMAL,   Manager::Get()._btnNormal   },
-          { ButtonState::PRESSED,  Manager::Get()._btnPressed  },
-          { ButtonState::HOVERED,  Manager::Get()._btnHover    },
-          { ButtonState::DISABLED, Manager::Get()._btnDisabled }
+          { ButtonState::NORMAL,   Manager::Get()._btnNormalSrc   },
+          { ButtonState::PRESSED,  Manager::Get()._btnPressedSrc  },
+          { ButtonState::HOVERED,  Manager::Get()._btnHoverSrc    },
+          { ButtonState::DISABLED, Manager::Get()._btnDisabledSrc }
         };
 
         for (auto& kvp : images)
         {
-          Image* img = Manager::Get().CreateImage(owner, transform, kvp.second);
+          Image* img = Manager::Get().CreateImage(owner,
+                                                  transform,
+                                                  Manager::Get()._atlas,
+                                                  kvp.second);
           img->SetSlicePoints({ 4, 4, 11, 11 });
           img->SetDrawType(Image::DrawType::SLICED);
           img->SetBlending(true);
           img->SetVisible(false);
           _imagesByState[kvp.first] = img;
+          AddPart(img);
         }
 
         _textString = text;
@@ -1514,9 +5084,14 @@ namespace RepaUI
         _collisionArea->SetBlending(true);
         _collisionArea->SetColor({ 0, 0, 0, 0 });
 
+        AddPart(_disabledText.first);
+        AddPart(_disabledText.second);
+        AddPart(_text);
+        AddPart(_collisionArea);
+
         SetState(ButtonState::NORMAL);
 
-        _collisionArea->_onMouseOverIntl =
+        _collisionArea->HandlerIntl(EventType::MOUSE_OVER).Connect(
         [this](Element* sender)
         {
           if (_clickStarted)
@@ -1527,23 +5102,23 @@ namespace RepaUI
           {
             SetState(ButtonState::HOVERED);
           }
-        };
+        });
 
-        _collisionArea->_onMouseOutIntl =
+        _collisionArea->HandlerIntl(EventType::MOUSE_OUT).Connect(
         [this](Element* sender)
         {
           SetState(ButtonState::NORMAL);
-        };
+        });
 
-        _collisionArea->_onMouseDownIntl =
+        _collisionArea->HandlerIntl(EventType::MOUSE_DOWN).Connect(
         [this](Element* sender)
         {
           SetState(ButtonState::PRESSED);
 
           _clickStarted = true;
-        };
+        });
 
-        _collisionArea->_onMouseUpIntl =
+        _collisionArea->HandlerIntl(EventType::MOUSE_UP).Connect(
         [this](Element* sender)
         {
           SetState(ButtonState::NORMAL);
@@ -1552,15 +5127,12 @@ namespace RepaUI
 
           if (_clickStarted && _clickEnded)
           {
-            if (CanBeCalled(OnClicked))
-            {
-              OnClicked(this);
-            }
+            _onClicked.Emit(this);
           }
 
           _clickStarted = false;
           _clickEnded   = false;
-        };
+        });
       }
 
       void SetTransform(const SDL_Rect& transform) override
@@ -1583,8 +5155,15 @@ namespace RepaUI
         SetState(val ? ButtonState::NORMAL : ButtonState::DISABLED);
       }
 
-      std::function<void(Button*)> OnClicked;
-      std::function<void(Button*)> OnHold;
+      Signal<Button*>& OnClicked()
+      {
+        return _onClicked;
+      }
+
+      Signal<Button*>& OnHold()
+      {
+        return _onHold;
+      }
 
     protected:
       void DrawImpl() override
@@ -1650,6 +5229,8 @@ namespace RepaUI
 
         _enabled = (newState == ButtonState::NORMAL);
 
+        UpdateHotData();
+
         bool textVisibility = (_state != ButtonState::DISABLED);
 
         _disabledText.first->SetVisible(!textVisibility);
@@ -1696,6 +5277,9 @@ namespace RepaUI
       bool _clickEnded   = false;
 
       std::string _textString;
+
+      Signal<Button*> _onClicked;
+      Signal<Button*> _onHold;
   };
 
 // =============================================================================
@@ -1705,112 +5289,387 @@ namespace RepaUI
   {
     std::unique_ptr<Canvas> canvas = std::make_unique<Canvas>(transform,
                                                               _rendRef);
-    uint64_t id = canvas->Id();
-    _canvases[id] = std::move(canvas);
-    return _canvases[id].get();
+    canvas->_hitGrid = &_canvasesGrid;
+    canvas->UpdateHotData();
+
+    canvas->_handle = _canvases.Insert(canvas.get());
+    return canvas.release();
+  }
+
+  Image* Manager::CreateImage(Canvas* canvas,
+                            const SDL_Rect& transform,
+                            SDL_Texture* image)
+  {
+    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
+    Image* img = new Image(c, image, transform);
+    return static_cast<Image*>(c->Add(img));
+  }
+
+  Image* Manager::CreateImage(Canvas* canvas,
+                              const SDL_Rect& transform,
+                              SDL_Texture* image,
+                              const SDL_Rect& imageSrc)
+  {
+    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
+    Image* img = new Image(c, image, transform, imageSrc);
+    return static_cast<Image*>(c->Add(img));
+  }
+
+  Image* Manager::CreateImage(Canvas* canvas,
+                              const SDL_Rect& transform,
+                              const ImageHandle& image)
+  {
+    if (!image.IsValid())
+    {
+      return CreateImage(canvas, transform, nullptr);
+    }
+
+    Image* img = CreateImage(canvas, transform, image.Texture, image.Src);
+    img->SetOpaqueSource(image.Opaque);
+
+    return img;
+  }
+
+  Text* Manager::CreateText(Canvas* canvas,
+                            const SDL_Rect& transform,
+                            const std::string& text)
+  {
+    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
+    Text* txt = new Text(c, transform, text);
+    return static_cast<Text*>(c->Add(txt));
+  }
+
+  Button* Manager::CreateButton(Canvas* canvas,
+                                const SDL_Rect& transform,
+                                const std::string& text)
+  {
+    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
+    Button* btn = new Button(c, transform, text);
+    return static_cast<Button*>(c->Add(btn));
+  }
+
+// =============================================================================
+//                         GUI ELEMENTS DESTRUCTION
+// =============================================================================
+  //
+  // Parts of composite element can't exist on their own,
+  // so the whole thing is destroyed.
+  //
+  void Manager::DestroyElement(Element* e)
+  {
+    if (e == nullptr || e->_destroyed)
+    {
+      return;
+    }
+
+    if (e->_owner == nullptr)
+    {
+      DestroyCanvas(static_cast<Canvas*>(e));
+      return;
+    }
+
+    while (e->_composite != nullptr)
+    {
+      e = e->_composite;
+    }
+
+    e->_owner->Remove(e);
+  }
+
+  void Manager::DestroyCanvas(Canvas* canvas)
+  {
+    if (canvas == nullptr || canvas->_destroyed)
+    {
+      return;
+    }
+
+    if (_canvases.Get(canvas->_handle) != canvas)
+    {
+      SDL_LogError(SDL_LOG_CATEGORY_ERROR,
+                   "Trying to destroy canvas not created by CreateCanvas()!");
+      return;
+    }
+
+    canvas->Invalidate();
+    canvas->_destroyed = true;
+
+    for (auto& e : canvas->_elements)
+    {
+      e->_destroyed = true;
+    }
+
+    if (_topCanvas == canvas)
+    {
+      _topCanvas = nullptr;
+    }
+
+    _canvasesGrid.Remove(canvas);
+
+    InvalidateMotionArea();
+
+    _destroyed.push_back(_canvases.Remove(canvas->_handle));
+  }
+
+  void Manager::DeleteDestroyed()
+  {
+    for (auto& e : _destroyed)
+    {
+      e->ReleaseTextures();
+    }
+
+    _destroyed.clear();
+  }
+
+// =============================================================================
+//                             IMPLEMENTATIONS
+// =============================================================================
+  bool Manager::Draw()
+  {
+    DeleteDestroyed();
+
+    if (!_redrawRequested)
+    {
+      return false;
+    }
+
+    _renderState.Reset();
+
+    auto old = _renderState.GetRenderTarget();
+
+    _oldRenderColor     = _renderState.GetDrawColor();
+    _oldRenderBlendMode = _renderState.GetDrawBlendMode();
+
+    DrawToTexture();
+    DrawOnScreen();
+
+    _renderState.SetRenderTarget(old);
+    _renderState.SetDrawColor(_oldRenderColor.r,
+                              _oldRenderColor.g,
+                              _oldRenderColor.b,
+                              _oldRenderColor.a);
+    _renderState.SetDrawBlendMode(_oldRenderBlendMode);
+
+    _redrawRequested = false;
+
+    return true;
   }
 
-  Image* Manager::CreateImage(Canvas* canvas,
-                            const SDL_Rect& transform,
-                            SDL_Texture* image)
-  {
-    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
-    Image* img = new Image(c, image, transform);
-    return static_cast<Image*>(c->Add(img));
-  }
+  void Manager::DrawToTexture()
+  {
+    if (_damagedRects.empty())
+    {
+      return;
+    }
+
+    //
+    // Canvases in the order they're composed,
+    // along with their opaque areas.
+    //
+    _composeOrder.clear();
+    _opaqueRects.clear();
+
+    for (auto& c : _canvases)
+    {
+      if (c->_visible)
+      {
+        _composeOrder.push_back(c.get());
+      }
+    }
+
+    if (_screenCanvas->_visible)
+    {
+      _composeOrder.push_back(_screenCanvas.get());
+    }
+
+    for (auto& c : _composeOrder)
+    {
+      _opaqueRects.push_back(c->OpaqueBounds());
+    }
+
+    //
+    // Only layers with damaged elements are redrawn,
+    // the rest are used as is.
+    // Canvas can only be covered by the ones composed after it.
+    //
+    size_t count = _composeOrder.size();
+
+    for (size_t i = 0; i < count; i++)
+    {
+      _composeOrder[i]->UpdateLayer(_opaqueRects.data() + i + 1,
+                                    count - i - 1);
+    }
+
+    _renderState.SetRenderTarget(_renderTexture);
+
+    SDL_Rect clip;
+
+    for (auto& dr : _damagedRects)
+    {
+      //
+      // SDL_RenderClear() ignores clip rect,
+      // so damaged area is cleared by filling it instead.
+      //
+      PushClipRect(dr);
+
+      _renderState.SetDrawBlendMode(SDL_BLENDMODE_NONE);
+      _renderState.SetDrawColor(0, 0, 0, 0);
+      SDL_RenderFillRect(_rendRef, &dr);
+
+      for (size_t i = 0; i < count; i++)
+      {
+        Canvas* c = _composeOrder[i];
+
+        if (SDL_IntersectRect(&c->_renderTransform, &dr, &clip)
+         && !IsOccluded(clip, i + 1))
+        {
+          c->Compose(clip);
+        }
+      }
+
+      PopClipRect();
+    }
 
-  Text* Manager::CreateText(Canvas* canvas,
-                            const SDL_Rect& transform,
-                            const std::string& text)
-  {
-    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
-    Text* txt = new Text(c, transform, text);
-    return static_cast<Text*>(c->Add(txt));
+    _damagedRects.clear();
   }
 
-  Button* Manager::CreateButton(Canvas* canvas,
-                                const SDL_Rect& transform,
-                                const std::string& text)
+  void Manager::DrawOnScreen()
   {
-    Canvas* c = (canvas == nullptr) ? _screenCanvas.get() : canvas;
-    Button* btn = new Button(c, transform, text);
-    return static_cast<Button*>(c->Add(btn));
+    _renderState.SetRenderTarget(nullptr);
+    _renderState.SetClipRect(nullptr);
+
+    CalculateScreenRegions();
+
+    //
+    // Render texture and the screen share coordinates,
+    // and every pixel is copied only once.
+    //
+    for (auto& r : _screenRegions)
+    {
+      SDL_RenderCopy(_rendRef,
+                     _renderTexture,
+                     &r,
+                     &r);
+    }
   }
 
-// =============================================================================
-//                             IMPLEMENTATIONS
-// =============================================================================
-  void Manager::Draw()
+  bool Manager::IsOccluded(const SDL_Rect& rect, size_t firstOccluder)
   {
-    SDL_GetRenderDrawColor(_rendRef,
-                          &_oldRenderColor.r,
-                          &_oldRenderColor.g,
-                          &_oldRenderColor.b,
-                          &_oldRenderColor.a);
-    DrawToTexture();
-    DrawOnScreen();
+    for (size_t i = firstOccluder; i < _opaqueRects.size(); i++)
+    {
+      if (Contains(_opaqueRects[i], rect))
+      {
+        return true;
+      }
+    }
 
-    SDL_SetRenderDrawColor(_rendRef,
-                           _oldRenderColor.r,
-                           _oldRenderColor.g,
-                           _oldRenderColor.b,
-                           _oldRenderColor.a);
+    return false;
   }
 
-  void Manager::DrawToTexture()
+  void Manager::CalculateScreenRegions()
   {
-    auto old = SDL_GetRenderTarget(_rendRef);
-    SDL_SetRenderTarget(_rendRef, _renderTexture);
-    SDL_SetTextureBlendMode(_renderTempTexture,
-                            SDL_BLENDMODE_BLEND);
-    SDL_SetRenderDrawColor(_rendRef, 0, 0, 0, 0);
-    SDL_RenderClear(_rendRef);
+    _screenRegions.clear();
+
+    SDL_Rect r;
 
-    for (auto& kvp : _canvases)
+    //
+    // Topmost first, so that covered canvases
+    // end up contributing nothing.
+    //
+    if (_screenCanvas->_visible)
     {
-      SDL_RenderSetClipRect(_rendRef, &kvp.second->_renderTransform);
-      kvp.second->Draw();
+      r = _screenCanvas->ContentBounds();
+      AddScreenRegion(r);
     }
 
-    SDL_SetRenderTarget(_rendRef, _renderTexture);
-    SDL_RenderSetClipRect(_rendRef, &_screenCanvas->_renderTransform);
-    _screenCanvas->Draw();
+    for (auto it = _canvases.rbegin(); it != _canvases.rend(); it++)
+    {
+      if ((*it)->_visible)
+      {
+        AddScreenRegion((*it)->_renderTransform);
+      }
+    }
 
-    SDL_SetRenderTarget(_rendRef, old);
+    MergeAdjacentRects(_screenRegions);
   }
 
-  void Manager::DrawOnScreen()
+  void Manager::AddScreenRegion(const SDL_Rect& rect)
   {
-    auto old = SDL_GetRenderTarget(_rendRef);
-    SDL_SetRenderTarget(_rendRef, nullptr);
+    SDL_Rect r;
 
-    for (auto it = _canvases.rbegin(); it != _canvases.rend(); it++)
+    if (!SDL_IntersectRect(&rect, &_renderDst, &r))
     {
-      auto& t = it->second->_transform;
-
-      SDL_RenderSetClipRect(_rendRef, &t);
-      SDL_RenderCopy(_rendRef,
-                     _renderTexture,
-                     &_renderDst,
-                     nullptr);
+      return;
     }
 
-    auto& t = _screenCanvas->_transform;
+    _regionPieces.clear();
+    _regionPieces.push_back(r);
+
+    for (auto& sr : _screenRegions)
+    {
+      _regionPiecesLeft.clear();
+
+      for (auto& p : _regionPieces)
+      {
+        SubtractRect(p, sr, _regionPiecesLeft);
+      }
+
+      std::swap(_regionPieces, _regionPiecesLeft);
 
-    SDL_RenderSetClipRect(_rendRef, &t);
-    SDL_RenderCopy(_rendRef,
-                   _renderTexture,
-                   &_renderDst,
-                   nullptr);
+      if (_regionPieces.empty())
+      {
+        return;
+      }
+    }
 
-    SDL_RenderSetClipRect(_rendRef, nullptr);
-    SDL_SetRenderTarget(_rendRef, old);
+    _screenRegions.insert(_screenRegions.end(),
+                          _regionPieces.begin(),
+                          _regionPieces.end());
   }
 
   void Manager::HandleEvents(const SDL_Event& evt)
   {
+    DeleteDestroyed();
+
     switch (evt.type)
     {
+      //
+      // Contents of render targets are lost,
+      // so everything has to be redrawn.
+      //
+      case SDL_RENDER_TARGETS_RESET:
+      case SDL_RENDER_DEVICE_RESET:
+      {
+        _targetsGeneration++;
+
+        for (auto& c : _canvases)
+        {
+          c->DamageLayer();
+        }
+
+        _screenCanvas->DamageLayer();
+
+        DamageAll();
+      }
+      break;
+
+      //
+      // Window contents must be presented again,
+      // though render texture itself is still valid.
+      //
+      case SDL_WINDOWEVENT:
+      {
+        switch (evt.window.event)
+        {
+          case SDL_WINDOWEVENT_EXPOSED:
+          case SDL_WINDOWEVENT_SHOWN:
+          case SDL_WINDOWEVENT_RESTORED:
+          case SDL_WINDOWEVENT_SIZE_CHANGED:
+            RequestRedraw();
+            break;
+        }
+      }
+      break;
+
       case SDL_MOUSEMOTION:
       case SDL_MOUSEBUTTONUP:
       case SDL_MOUSEBUTTONDOWN:
@@ -1821,25 +5680,83 @@ namespace RepaUI
         {
           ProcessCanvases(evt);
         }
+
+        if (_motionFilter)
+        {
+          UpdateMotionArea(evt);
+        }
       }
       break;
     }
   }
 
-  void Manager::ProcessCanvases(const SDL_Event& evt)
+  //
+  // Run of motion events is broken by any other event,
+  // so that buttons are still pressed and released
+  // at the position they were pressed and released at.
+  //
+  void Manager::HandleEventBatch(const SDL_Event* events, size_t count)
+  {
+    size_t i = 0;
+
+    while (i < count)
+    {
+      if (!_coalesceMotion || events[i].type != SDL_MOUSEMOTION)
+      {
+        HandleEvents(events[i]);
+        i++;
+        continue;
+      }
+
+      SDL_Event last = events[i];
+
+      i++;
+
+      while (i < count
+          && events[i].type == SDL_MOUSEMOTION
+          && events[i].motion.windowID == last.motion.windowID
+          && events[i].motion.which == last.motion.which)
+      {
+        int xrel = last.motion.xrel + events[i].motion.xrel;
+        int yrel = last.motion.yrel + events[i].motion.yrel;
+
+        last = events[i];
+
+        last.motion.xrel = xrel;
+        last.motion.yrel = yrel;
+
+        i++;
+      }
+
+      HandleEvents(last);
+    }
+  }
+
+  Canvas* Manager::FindCanvas(const SDL_Event& evt)
   {
-    Canvas* newCanvas = nullptr;
+    if (_canvasesGrid.Contains(evt.motion.x, evt.motion.y))
+    {
+      return static_cast<Canvas*>(_canvasesGrid.Find(evt.motion.x,
+                                                     evt.motion.y,
+                                                     evt));
+    }
 
     for (auto it = _canvases.rbegin(); it != _canvases.rend(); it++)
     {
-      if (it->second->IsEnabledAndVisible()
-       && it->second->IsMouseInside(evt))
+      if ((*it)->IsEnabledAndVisible()
+       && (*it)->IsMouseInside(evt))
       {
-        newCanvas = it->second.get();
-        break;
+        return it->get();
       }
     }
 
+    return nullptr;
+  }
+
+  void Manager::ProcessCanvases(const SDL_Event& evt)
+  {
+    Canvas* newCanvas = FindCanvas(evt);
+
     //
     // If we moused out from canvas, we still need
     // to let it handle event for the last time
@@ -1851,21 +5768,38 @@ namespace RepaUI
       if (_topCanvas != nullptr
        && _topCanvas->IsEnabledAndVisible())
       {
-        if (_topCanvas->_topElement != nullptr)
-        {
-          _topCanvas->_topElement->RaiseEvent(EventType::MOUSE_OUT);
-          _topCanvas->_topElement->_mouseEnter = false;
+        Element* topElement = _topCanvas->_topElement;
 
+        if (topElement != nullptr)
+        {
           //
           // To prevent OnMouseOut() duplicate firing
           // if we mouse outed from clipped element
           // and overed again on an empty spot on the canvas.
           //
           _topCanvas->_topElement = nullptr;
+
+          topElement->RaiseEvent(EventType::MOUSE_OUT);
+          topElement->_mouseEnter = false;
+        }
+
+        //
+        // Handler above may have destroyed the canvas,
+        // which resets _topCanvas.
+        //
+        if (_topCanvas != nullptr)
+        {
+          _topCanvas->RaiseEvent(EventType::MOUSE_OUT);
+          _topCanvas->_mouseEnter = false;
         }
+      }
 
-        _topCanvas->RaiseEvent(EventType::MOUSE_OUT);
-        _topCanvas->_mouseEnter = false;
+      //
+      // Same goes for the new one, destroyed by any of OnMouseOut().
+      //
+      if (newCanvas != nullptr && newCanvas->_destroyed)
+      {
+        newCanvas = nullptr;
       }
 
       _topCanvas = newCanvas;
@@ -1877,6 +5811,217 @@ namespace RepaUI
     }
   }
 
+  void Manager::SetMotionFilter(bool enabled)
+  {
+    if (_motionFilter == enabled)
+    {
+      return;
+    }
+
+    if (enabled)
+    {
+      if (!SDL_GetEventFilter(&_prevFilter, &_prevFilterData))
+      {
+        _prevFilter     = nullptr;
+        _prevFilterData = nullptr;
+      }
+
+      _motionFilter = true;
+
+      InvalidateMotionArea();
+
+      SDL_SetEventFilter(&Manager::FilterEvent, this);
+    }
+    else
+    {
+      SDL_SetEventFilter(_prevFilter, _prevFilterData);
+
+      InvalidateMotionArea();
+
+      _motionFilter = false;
+    }
+  }
+
+  int SDLCALL Manager::FilterEvent(void* userdata, SDL_Event* evt)
+  {
+    Manager* m = static_cast<Manager*>(userdata);
+
+    if (m->_prevFilter != nullptr
+     && m->_prevFilter(m->_prevFilterData, evt) == 0)
+    {
+      return 0;
+    }
+
+    if (evt->type != SDL_MOUSEMOTION)
+    {
+      return 1;
+    }
+
+    SDL_AtomicLock(&m->_motionLock);
+
+    bool drop = (evt->motion.windowID == m->_windowId
+              && m->_motionArea.Contains(evt->motion.x, evt->motion.y));
+
+    //
+    // Area belongs to the last handled event, not the last queued one.
+    // Once mouse leaves it, moving back must not be dropped either,
+    // so nothing is until this event is handled and area is updated.
+    //
+    if (!drop)
+    {
+      m->_motionArea = MotionArea();
+    }
+
+    SDL_AtomicUnlock(&m->_motionLock);
+
+    return drop ? 0 : 1;
+  }
+
+  //
+  // Called after mouse event is handled.
+  //
+  void Manager::UpdateMotionArea(const SDL_Event& evt)
+  {
+    MotionArea area = MotionArea::Everything();
+
+    if (!IsHoverUpToDate(evt)
+     || !CalculateMotionArea(evt.motion.x, evt.motion.y, area))
+    {
+      area = MotionArea();
+    }
+
+    SDL_AtomicLock(&_motionLock);
+    _motionArea = area;
+    SDL_AtomicUnlock(&_motionLock);
+  }
+
+  //
+  // Handlers may have added, shown or moved something
+  // under the mouse, which only becomes hovered
+  // on next motion event, so that one must not be dropped.
+  //
+  bool Manager::IsHoverUpToDate(const SDL_Event& evt)
+  {
+    if (!_screenCanvas->IsEnabledAndVisible()
+     || !IsHoverUpToDate(_screenCanvas.get(), evt))
+    {
+      return false;
+    }
+
+    if (_screenCanvas->_topElement != nullptr)
+    {
+      return true;
+    }
+
+    if (FindCanvas(evt) != _topCanvas)
+    {
+      return false;
+    }
+
+    return (_topCanvas == nullptr || IsHoverUpToDate(_topCanvas, evt));
+  }
+
+  bool Manager::IsHoverUpToDate(Canvas* canvas, const SDL_Event& evt)
+  {
+    Element* top = canvas->FindElement(evt);
+
+    return (canvas->_mouseEnter == canvas->IsMouseInside(evt)
+         && top == canvas->_topElement
+         && (top == nullptr || top->_mouseEnter));
+  }
+
+  //
+  // Follows the same path as HandleEvents(),
+  // but instead of finding what's under the point
+  // finds where that stays the same.
+  // Returns false if any point around can change something.
+  //
+  bool Manager::CalculateMotionArea(int x, int y, MotionArea& area)
+  {
+    if (!_screenCanvas->IsEnabledAndVisible()
+     || !AddCanvasToMotionArea(_screenCanvas.get(), x, y, area))
+    {
+      return false;
+    }
+
+    if (_screenCanvas->_topElement != nullptr)
+    {
+      return true;
+    }
+
+    if (!_canvasesGrid.Contains(x, y))
+    {
+      return false;
+    }
+
+    area.Intersect(_canvasesGrid.CellRect(x, y));
+
+    for (auto c : _canvasesGrid.CellAt(x, y))
+    {
+      if (c->IsEnabledAndVisible())
+      {
+        area.Separate(x, y, c->_transform);
+      }
+    }
+
+    if (_topCanvas != nullptr)
+    {
+      return AddCanvasToMotionArea(_topCanvas, x, y, area);
+    }
+
+    return true;
+  }
+
+  bool Manager::AddCanvasToMotionArea(Canvas* canvas,
+                                      int x,
+                                      int y,
+                                      MotionArea& area)
+  {
+    uint16_t move = Element::ListenersOf((size_t)EventType::MOUSE_MOVE);
+
+    Element* top = canvas->_topElement;
+
+    if ((canvas->_listeners & move) != 0
+     || (top != nullptr && (top->_listeners & move) != 0))
+    {
+      return false;
+    }
+
+    auto& t = canvas->_transform;
+
+    int lx = x - t.x;
+    int ly = y - t.y;
+
+    if (!canvas->_elementsGrid.Contains(lx, ly))
+    {
+      return false;
+    }
+
+    SDL_Rect cell = canvas->_elementsGrid.CellRect(lx, ly);
+
+    cell.x += t.x;
+    cell.y += t.y;
+
+    area.Intersect(cell);
+
+    //
+    // Canvas itself, and clip check of its elements,
+    // which compares x with canvas' y as well.
+    //
+    area.Separate(x, y, t);
+    area.SeparateX(x, t.y);
+
+    for (auto e : canvas->_elementsGrid.CellAt(lx, ly))
+    {
+      if (e->IsEnabledAndVisible())
+      {
+        area.Separate(x, y, e->_transform);
+      }
+    }
+
+    return true;
+  }
+
 // =============================================================================
 //                              SHORTCUTS
 // =============================================================================
@@ -1890,9 +6035,29 @@ namespace RepaUI
     Manager::Get().HandleEvents(evt);
   }
 
-  void Draw()
+  void HandleEventBatch(const SDL_Event* events, size_t count)
+  {
+    Manager::Get().HandleEventBatch(events, count);
+  }
+
+  void SetMotionCoalescing(bool enabled)
+  {
+    Manager::Get().SetMotionCoalescing(enabled);
+  }
+
+  void SetMotionFilter(bool enabled)
+  {
+    Manager::Get().SetMotionFilter(enabled);
+  }
+
+  bool Draw()
   {
-    Manager::Get().Draw();
+    return Manager::Get().Draw();
+  }
+
+  bool NeedsRedraw()
+  {
+    return Manager::Get().NeedsRedraw();
   }
 
   Canvas* CreateCanvas(const SDL_Rect& transform)
@@ -1900,6 +6065,21 @@ namespace RepaUI
     return Manager::Get().CreateCanvas(transform);
   }
 
+  Canvas* GetCanvas(const ElementHandle& handle)
+  {
+    return Manager::Get().GetCanvas(handle);
+  }
+
+  void DestroyCanvas(Canvas* canvas)
+  {
+    Manager::Get().DestroyCanvas(canvas);
+  }
+
+  void DestroyElement(Element* e)
+  {
+    Manager::Get().DestroyElement(e);
+  }
+
   Image* CreateImage(Canvas* canvas,
                    const SDL_Rect& transform,
                    SDL_Texture* image)
@@ -1907,6 +6087,26 @@ namespace RepaUI
     return Manager::Get().CreateImage(canvas, transform, image);
   }
 
+  Image* CreateImage(Canvas* canvas,
+                     const SDL_Rect& transform,
+                     SDL_Texture* image,
+                     const SDL_Rect& imageSrc)
+  {
+    return Manager::Get().CreateImage(canvas, transform, image, imageSrc);
+  }
+
+  Image* CreateImage(Canvas* canvas,
+                     const SDL_Rect& transform,
+                     const ImageHandle& image)
+  {
+    return Manager::Get().CreateImage(canvas, transform, image);
+  }
+
+  ImageHandle RegisterImage(SDL_Surface* surface)
+  {
+    return Manager::Get().RegisterImage(surface);
+  }
+
   Text* CreateText(Canvas* canvas,
                    const SDL_Rect& transform,
                    const std::string& text)